@@ -38,7 +38,7 @@
 
 #include "libbb.h"
 
-/* This is a NOEXEC applet. Be very careful! */
+/* This is a NOFORK applet. Be very careful! */
 
 
 #define OPT_RECURSE (option_mask32 & 1)
@@ -95,6 +95,7 @@ int chmod_main(int argc UNUSED_PARAM, char **argv)
 	int retval = EXIT_SUCCESS;
 	char *arg, **argp;
 	char *smode;
+	unsigned flags;
 
 	/* Convert first encountered -r into ar, -w into aw etc
 	 * so that getopt would not eat it */
@@ -123,9 +124,14 @@ int chmod_main(int argc UNUSED_PARAM, char **argv)
 
 	/* Ok, ready to do the deed now */
 	smode = *argv++;
+	flags = OPT_RECURSE;
+	/* Octal mode does not depend on the old one. Then fileAction
+	 * needs only file type (to skip links), unless we do -c */
+	if ((unsigned char)(smode[0] - '0') < 8 && !OPT_CHANGED)
+		flags |= ACTION_NO_STAT;
 	do {
 		if (!recursive_action(*argv,
-			OPT_RECURSE,    // recurse
+			flags,          // recurse
 			fileAction,     // file action
 			fileAction,     // dir action
 			smode,          // user data
@@ -37,7 +37,7 @@
 
 #include "libbb.h"
 
-/* This is a NOEXEC applet. Be very careful! */
+/* This is a NOFORK applet. Be very careful! */
 
 
 #define OPT_STR     ("Rh" IF_DESKTOP("vcfLHP"))
@@ -141,6 +141,13 @@ int chown_main(int argc UNUSED_PARAM, char **argv)
 		flags |= ACTION_FOLLOWLINKS; /* follow links if -L */
 
 	parse_chown_usergroup_or_die(&param.ugid, argv[0]);
+	/* fileAction needs stat data only to fill in missing uid or gid,
+	 * and for -c */
+	if (param.ugid.uid != (uid_t)-1L && param.ugid.gid != (gid_t)-1L
+	 && !OPT_CHANGED
+	) {
+		flags |= ACTION_NO_STAT;
+	}
 
 	/* Ok, ready to do the deed now */
 	while (*++argv) {
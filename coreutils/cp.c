@@ -31,6 +31,9 @@
 //usage:     "\n	-f	Overwrite"
 //usage:     "\n	-i	Prompt before overwrite"
 //usage:     "\n	-l,-s	Create (sym)links"
+//usage:	IF_FEATURE_CP_REFLINK(
+//usage:     "\n	--reflink[=always|auto]	Share data blocks with SOURCE if fs supports it"
+//usage:	)
 
 #include "libbb.h"
 #include "libcoreutils/coreutils.h"
@@ -55,8 +58,12 @@ int cp_main(int argc, char **argv)
 		OPT_v = 1 << (sizeof(FILEUTILS_CP_OPTSTR)+2),
 #if ENABLE_FEATURE_CP_LONG_OPTIONS
 		OPT_parents = 1 << (sizeof(FILEUTILS_CP_OPTSTR)+3),
+		OPT_reflink = (1 << (sizeof(FILEUTILS_CP_OPTSTR)+4)) * ENABLE_FEATURE_CP_REFLINK,
 #endif
 	};
+#if ENABLE_FEATURE_CP_REFLINK
+	const char *reflink = NULL;
+#endif
 
 	// Need at least two arguments
 	// Soft- and hardlinking doesn't mix
@@ -77,10 +84,26 @@ int cp_main(int argc, char **argv)
 		"symbolic-link\0"  No_argument "s"
 		"verbose\0"        No_argument "v"
 		"parents\0"        No_argument "\xff"
+		IF_FEATURE_CP_REFLINK(
+		"reflink\0"        Optional_argument "\xfe"
+		)
 		;
 #endif
 	// -v (--verbose) is ignored
-	flags = getopt32(argv, FILEUTILS_CP_OPTSTR "arPv");
+	flags = getopt32(argv, FILEUTILS_CP_OPTSTR "arPv"
+			IF_FEATURE_CP_REFLINK(, &reflink)
+	);
+#if ENABLE_FEATURE_CP_REFLINK
+	if (flags & OPT_reflink) {
+		/* --reflink is --reflink=always */
+		if (!reflink || strcmp(reflink, "always") == 0)
+			flags |= FILEUTILS_REFLINK | FILEUTILS_REFLINK_ALWAYS;
+		else if (strcmp(reflink, "auto") == 0)
+			flags |= FILEUTILS_REFLINK;
+		else if (strcmp(reflink, "never") != 0)
+			bb_error_msg_and_die("invalid argument '%s' for '%s'", reflink, "--reflink");
+	}
+#endif
 	/* Options of cp from GNU coreutils 6.10:
 	 * -a, --archive
 	 * -f, --force
@@ -111,6 +134,7 @@ int cp_main(int argc, char **argv)
 	 *	remove  each existing destination file before attempting to open
 	 * --sparse=WHEN
 	 *	control creation of sparse files
+	 *	(we always keep holes, as with --sparse=auto)
 	 * --strip-trailing-slashes
 	 *	remove any trailing slashes from each SOURCE argument
 	 * -S, --suffix=SUFFIX
@@ -144,6 +168,15 @@ int cp_main(int argc, char **argv)
 	}
 #endif
 
+#if ENABLE_FEATURE_CP_PARALLEL
+	if ((flags & FILEUTILS_RECUR)
+	 && !(flags & (FILEUTILS_INTERACTIVE|FILEUTILS_MAKE_HARDLINK|FILEUTILS_MAKE_SOFTLINK
+			IF_SELINUX(|FILEUTILS_PRESERVE_SECURITY_CONTEXT|FILEUTILS_SET_SECURITY_CONTEXT)))
+	) {
+		copy_file_parallel_start();
+	}
+#endif
+
 	status = EXIT_SUCCESS;
 	last = argv[argc - 1];
 	/* If there are only two arguments and...  */
@@ -184,7 +217,9 @@ int cp_main(int argc, char **argv)
 			dest_dup = xstrdup(dest);
 			dest_dir = dirname(dest_dup);
 			if (bb_make_directory(dest_dir, -1, FILEUTILS_RECUR)) {
-				return EXIT_FAILURE;
+				/* wait for copies already started */
+				status = EXIT_FAILURE;
+				break;
 			}
 			free(dest_dup);
 			goto DO_COPY;
@@ -202,6 +237,10 @@ int cp_main(int argc, char **argv)
 		/* don't move up: dest may be == last and not malloced! */
 		free((void*)dest);
 	}
+#if ENABLE_FEATURE_CP_PARALLEL
+	if (copy_file_parallel_finish() < 0)
+		status = EXIT_FAILURE;
+#endif
 
 	/* Exit. We are NOEXEC, not NOFORK. We do exit at the end of main() */
 	return status;
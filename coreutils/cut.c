@@ -299,7 +299,7 @@ int cut_main(int argc UNUSED_PARAM, char **argv)
 			fclose_if_not_stdin(file);
 		} while (*++argv);
 
-		if (ENABLE_FEATURE_CLEAN_UP)
+		if (ENABLE_FEATURE_CLEAN_UP || running_nofork)
 			free(cut_lists);
 		fflush_stdout_and_exit(retval);
 	}
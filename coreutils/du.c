@@ -84,6 +84,9 @@ struct globals {
 	int slink_depth;
 	int du_depth;
 	dev_t dir_dev;
+	char *path;
+	unsigned path_len;
+	unsigned path_size;
 } FIX_ALIASING;
 #define G (*(struct globals*)&bb_common_bufsiz1)
 #define INIT_G() do { } while (0)
@@ -107,14 +110,35 @@ static void print(unsigned long long size, const char *filename)
 #endif
 }
 
-/* tiny recursive du */
-static unsigned long long du(const char *filename)
+/* Append "/name" to G.path, return old length to restore it later */
+static unsigned path_push(const char *name)
+{
+	unsigned old_len = G.path_len;
+	unsigned len = strlen(name);
+
+	if (old_len + len + 2 > G.path_size) {
+		G.path_size = old_len + len + 256;
+		G.path = xrealloc(G.path, G.path_size);
+	}
+	if (old_len && G.path[old_len - 1] != '/')
+		G.path[G.path_len++] = '/';
+	memcpy(G.path + G.path_len, name, len + 1);
+	G.path_len += len;
+	return old_len;
+}
+
+/* tiny recursive du.
+ * name is relative to dir_fd, G.path holds the full name to show.
+ * Using *at() functions, kernel does not have to look up
+ * every component of a long pathname for every file.
+ */
+static unsigned long long du(int dir_fd, const char *name)
 {
 	struct stat statbuf;
 	unsigned long long sum;
 
-	if (lstat(filename, &statbuf) != 0) {
-		bb_simple_perror_msg(filename);
+	if (fstatat(dir_fd, name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
+		bb_simple_perror_msg(G.path);
 		G.status = EXIT_FAILURE;
 		return 0;
 	}
@@ -131,8 +155,8 @@ static unsigned long long du(const char *filename)
 
 	if (S_ISLNK(statbuf.st_mode)) {
 		if (G.slink_depth > G.du_depth) { /* -H or -L */
-			if (stat(filename, &statbuf) != 0) {
-				bb_simple_perror_msg(filename);
+			if (fstatat(dir_fd, name, &statbuf, 0) != 0) {
+				bb_simple_perror_msg(G.path);
 				G.status = EXIT_FAILURE;
 				return 0;
 			}
@@ -157,22 +181,29 @@ static unsigned long long du(const char *filename)
 	if (S_ISDIR(statbuf.st_mode)) {
 		DIR *dir;
 		struct dirent *entry;
-		char *newfile;
+		int fd;
 
-		dir = warn_opendir(filename);
+		/* We already know it's a dir (or a followed link to one) */
+		fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY);
+		dir = (fd >= 0) ? fdopendir(fd) : NULL;
 		if (!dir) {
+			bb_perror_msg("can't open '%s'", G.path);
+			if (fd >= 0)
+				close(fd);
 			G.status = EXIT_FAILURE;
 			return sum;
 		}
 
 		while ((entry = readdir(dir))) {
-			newfile = concat_subpath_file(filename, entry->d_name);
-			if (newfile == NULL)
+			unsigned len;
+
+			if (DOT_OR_DOTDOT(entry->d_name))
 				continue;
+			len = path_push(entry->d_name);
 			++G.du_depth;
-			sum += du(newfile);
+			sum += du(fd, entry->d_name);
 			--G.du_depth;
-			free(newfile);
+			G.path[G.path_len = len] = '\0';
 		}
 		closedir(dir);
 	} else {
@@ -180,7 +211,7 @@ static unsigned long long du(const char *filename)
 			return sum;
 	}
 	if (G.du_depth <= G.max_print_depth) {
-		print(sum, filename);
+		print(sum, G.path);
 	}
 	return sum;
 }
@@ -254,12 +285,18 @@ int du_main(int argc UNUSED_PARAM, char **argv)
 
 	slink_depth_save = G.slink_depth;
 	total = 0;
+	/* It would walk other filesystems we are not going to look at */
+	if (!(opt & OPT_x_one_FS))
+		tree_readahead_start(argv);
 	do {
-		total += du(*argv);
+		G.path_len = 0;
+		path_push(*argv);
+		total += du(AT_FDCWD, *argv);
 		/* otherwise du /dir /dir won't show /dir twice: */
 		reset_ino_dev_hashtable();
 		G.slink_depth = slink_depth_save;
 	} while (*++argv);
+	tree_readahead_stop();
 
 	if (opt & OPT_c_total)
 		print(total, "total");
@@ -322,9 +322,11 @@ static VALUE *eval6(void)
 	static const char keywords[] ALIGN1 =
 		"quote\0""length\0""match\0""index\0""substr\0";
 
+	/* Not static: eval6() recurses, and "substr S index A B N"
+	 * used to free outer l while evaluating index */
 	VALUE *r, *i1, *i2;
-	static VALUE *l = NULL;
-	static VALUE *v = NULL;
+	VALUE *l = l; /* for compiler */
+	VALUE *v = v;
 	int key = *G.args ? index_in_strings(keywords, *G.args) + 1 : 0;
 
 	if (key == 0) /* not a keyword */
@@ -519,6 +521,7 @@ int expr_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int expr_main(int argc UNUSED_PARAM, char **argv)
 {
 	VALUE *v;
+	int r;
 
 	INIT_G();
 
@@ -534,5 +537,7 @@ int expr_main(int argc UNUSED_PARAM, char **argv)
 		printf("%" PF_REZ "d\n", PF_REZ_TYPE v->u.i);
 	else
 		puts(v->u.s);
-	fflush_stdout_and_exit(null(v));
+	r = null(v);
+	freev(v); /* we may be running NOFORK */
+	fflush_stdout_and_exit(r);
 }
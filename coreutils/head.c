@@ -127,7 +127,7 @@ int head_main(int argc, char **argv)
 	do {
 		fp = fopen_or_warn_stdin(*argv);
 		if (fp) {
-			if (fp == stdin) {
+			if (LONE_DASH(*argv)) {
 				*argv = (char *) bb_msg_standard_input;
 			}
 			if (header_threshhold) {
@@ -36,7 +36,7 @@
 //usage:	IF_FEATURE_LS_FILETYPES("Fp") "lins"
 //usage:	IF_FEATURE_LS_TIMESTAMPS("e")
 //usage:	IF_FEATURE_HUMAN_READABLE("h")
-//usage:	IF_FEATURE_LS_SORTFILES("rSXv")
+//usage:	IF_FEATURE_LS_SORTFILES("rSXvfU")
 //usage:	IF_FEATURE_LS_TIMESTAMPS("ctu")
 //usage:	IF_SELINUX("kKZ") "]"
 //usage:	IF_FEATURE_AUTOWIDTH(" [-w WIDTH]") " [FILE]..."
@@ -74,6 +74,8 @@
 //usage:     "\n	-S	Sort by size"
 //usage:     "\n	-X	Sort by extension"
 //usage:     "\n	-v	Sort by version"
+//usage:     "\n	-U	Don't sort, list entries in directory order"
+//usage:     "\n	-f	Same as -aU"
 //usage:	)
 //usage:	IF_FEATURE_LS_TIMESTAMPS(
 //usage:     "\n	-c	With -l: sort by ctime"
@@ -95,6 +97,10 @@
 #include "libbb.h"
 #include "unicode.h"
 
+#ifndef DTTOIF
+# define DTTOIF(dirtype) ((dirtype) << 12)
+#endif
+
 
 /* This is a NOEXEC applet. Be very careful! */
 
@@ -171,7 +177,8 @@ SORT_MTIME      = 4 << 24,      /* sort by last modification time */
 SORT_VERSION    = 5 << 24,      /* sort by version */
 SORT_EXT        = 6 << 24,      /* sort by file name extension */
 SORT_DIR        = 7 << 24,      /* sort by file or directory */
-SORT_MASK       = (7 << 24) * ENABLE_FEATURE_LS_SORTFILES,
+SORT_NONE       = 8 << 24,      /* directory order, -U */
+SORT_MASK       = (15 << 24) * ENABLE_FEATURE_LS_SORTFILES,
 
 LIST_LONG       = LIST_MODEBITS | LIST_NLINKS | LIST_ID_NAME | LIST_SIZE | \
                   LIST_DATE_TIME | LIST_SYMLINK,
@@ -184,13 +191,13 @@ LIST_LONG       = LIST_MODEBITS | LIST_NLINKS | LIST_ID_NAME | LIST_SIZE | \
 /*          Std has -k which means "show sizes in kbytes" */
 /* -LHRctur Std options, busybox optionally supports */
 /* -Fp      Std options, busybox optionally supports */
-/* -SXvhTw  GNU options, busybox optionally supports */
+/* -SXvhTwfU GNU options, busybox optionally supports */
 /* -T WIDTH Ignored (we don't use tabs on output) */
 /* -KZ      SELinux mandated options, busybox optionally supports */
 /*          (coreutils 8.4 has no -K, remove it?) */
 /* -e       I think we made this one up (looks similar to GNU --full-time) */
-/* We already used up all 32 bits, if we need to add more, candidates for removal: */
-/* -K, -T, -e (add --full-time instead) */
+/* We use more than 32 bits, hence getopt64. Options which are tested
+ * through option_mask32 must stay below bit 32 */
 static const char ls_options[] ALIGN1 =
 	"Cadil1gnsxQAk"      /* 13 opts, total 13 */
 	IF_FEATURE_LS_TIMESTAMPS("cetu") /* 4, 17 */
@@ -201,7 +208,8 @@ static const char ls_options[] ALIGN1 =
 	IF_FEATURE_LS_FOLLOWLINKS("LH")  /* 2, 28 */
 	IF_FEATURE_HUMAN_READABLE("h")   /* 1, 29 */
 	IF_FEATURE_AUTOWIDTH("T:w:")     /* 2, 31 */
-	/* with --color, we use all 32 bits */;
+	IF_FEATURE_LS_SORTFILES("fU")    /* 2, 33 */
+	/* with --color, we use 34 bits */;
 enum {
 	//OPT_C = (1 << 0),
 	//OPT_a = (1 << 1),
@@ -235,7 +243,9 @@ enum {
 	OPTBIT_h = OPTBIT_L + 2 * ENABLE_FEATURE_LS_FOLLOWLINKS,
 	OPTBIT_T = OPTBIT_h + 1 * ENABLE_FEATURE_HUMAN_READABLE,
 	OPTBIT_w, /* 30 */
-	OPTBIT_color = OPTBIT_T + 2 * ENABLE_FEATURE_AUTOWIDTH,
+	OPTBIT_f = OPTBIT_T + 2 * ENABLE_FEATURE_AUTOWIDTH,
+	OPTBIT_U, /* 32 */
+	OPTBIT_color = OPTBIT_f + 2 * ENABLE_FEATURE_LS_SORTFILES,
 
 	OPT_c = (1 << OPTBIT_c) * ENABLE_FEATURE_LS_TIMESTAMPS,
 	OPT_e = (1 << OPTBIT_e) * ENABLE_FEATURE_LS_TIMESTAMPS,
@@ -255,8 +265,11 @@ enum {
 	OPT_h = (1 << OPTBIT_h) * ENABLE_FEATURE_HUMAN_READABLE,
 	OPT_T = (1 << OPTBIT_T) * ENABLE_FEATURE_AUTOWIDTH,
 	OPT_w = (1 << OPTBIT_w) * ENABLE_FEATURE_AUTOWIDTH,
-	OPT_color = (1 << OPTBIT_color) * ENABLE_FEATURE_LS_COLOR,
 };
+/* These can be above bit 31 */
+#define OPT_f     ((uint64_t)ENABLE_FEATURE_LS_SORTFILES << OPTBIT_f)
+#define OPT_U     ((uint64_t)ENABLE_FEATURE_LS_SORTFILES << OPTBIT_U)
+#define OPT_color ((uint64_t)ENABLE_FEATURE_LS_COLOR << OPTBIT_color)
 
 /* TODO: simple toggles may be stored as OPT_xxx bits instead */
 static const uint32_t opt_flags[] = {
@@ -353,6 +366,10 @@ struct globals {
 # define G_show_color 0
 #endif
 	smallint exit_code;
+	/* Readdir's d_type is enough, no need to stat directory entries */
+	smallint no_stat;
+	/* Unsorted one-per-line output: print entries as we read them */
+	smallint stream;
 	unsigned all_fmt;
 #if ENABLE_FEATURE_AUTOWIDTH
 	unsigned terminal_width;
@@ -929,9 +946,27 @@ static int sortcmp(const void *a, const void *b)
 	return (G.all_fmt & SORT_REVERSE) ? -(int)dif : (int)dif;
 }
 
+/* Plain "ls": no need to go through all the checks above */
+static int sortcmp_name(const void *a, const void *b)
+{
+	struct dnode *d1 = *(struct dnode **)a;
+	struct dnode *d2 = *(struct dnode **)b;
+
+	if (ENABLE_LOCALE_SUPPORT)
+		return strcoll(d1->name, d2->name);
+	return strcmp(d1->name, d2->name);
+}
+
 static void dnsort(struct dnode **dn, int size)
 {
-	qsort(dn, size, sizeof(*dn), sortcmp);
+	unsigned sort_opts = G.all_fmt & SORT_MASK;
+
+	if (sort_opts == SORT_NONE) /* -r has no effect too */
+		return;
+	if (sort_opts == SORT_NAME && !(G.all_fmt & SORT_REVERSE))
+		qsort(dn, size, sizeof(*dn), sortcmp_name);
+	else
+		qsort(dn, size, sizeof(*dn), sortcmp);
 }
 
 static void sort_and_display_files(struct dnode **dn, unsigned nfiles)
@@ -944,7 +979,24 @@ static void sort_and_display_files(struct dnode **dn, unsigned nfiles)
 # define sort_and_display_files(dn, nfiles) display_files(dn, nfiles)
 #endif
 
-/* Returns NULL-terminated malloced vector of pointers (or NULL) */
+/* A dnode for a directory entry, from d_type alone */
+static struct dnode *dnode_from_dirent(char *fullname, unsigned char d_type)
+{
+	struct dnode *cur;
+
+	if (d_type == DT_UNKNOWN)
+		return my_stat(fullname, bb_basename(fullname), 0);
+	cur = xzalloc(sizeof(*cur));
+	cur->fullname = fullname;
+	cur->name = bb_basename(fullname);
+	cur->dn_mode = DTTOIF(d_type);
+	return cur;
+}
+
+/* Returns NULL-terminated malloced vector of pointers (or NULL).
+ * If G.stream, entries are displayed right away
+ * and only directories are kept (they are needed for -R).
+ */
 static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p)
 {
 	struct dnode *dn, *cur, **dnp;
@@ -974,12 +1026,26 @@ static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p)
 				continue;
 		}
 		fullname = concat_path_file(path, entry->d_name);
-		cur = my_stat(fullname, bb_basename(fullname), 0);
+		if (G.no_stat)
+			cur = dnode_from_dirent(fullname, entry->d_type);
+		else
+			cur = my_stat(fullname, bb_basename(fullname), 0);
 		if (!cur) {
 			free(fullname);
 			continue;
 		}
 		cur->fname_allocated = 1;
+		if (G.stream) {
+			display_single(cur);
+			bb_putchar('\n');
+			if (!(ENABLE_FEATURE_LS_RECURSIVE && (G.all_fmt & DISP_RECURSIVE))
+			 || !S_ISDIR(cur->dn_mode)
+			) {
+				free(fullname);
+				free(cur);
+				continue;
+			}
+		}
 		cur->dn_next = dn;
 		dn = cur;
 		nfiles++;
@@ -994,11 +1060,10 @@ static struct dnode **scan_one_dir(const char *path, unsigned *nfiles_p)
 	 */
 	*nfiles_p = nfiles;
 	dnp = dnalloc(nfiles);
-	for (i = 0; /* i < nfiles - detected via !dn below */; i++) {
-		dnp[i] = dn;	/* save pointer to node in array */
+	/* list is in reverse readdir order, fill array from the end */
+	for (i = nfiles; i != 0; ) {
+		dnp[--i] = dn;	/* save pointer to node in array */
 		dn = dn->dn_next;
-		if (!dn)
-			break;
 	}
 
 	return dnp;
@@ -1052,7 +1117,8 @@ static void scan_and_display_dirs_recur(struct dnode **dn, int first)
 #endif
 		if (nfiles > 0) {
 			/* list all files at this level */
-			sort_and_display_files(subdnp, nfiles);
+			if (!G.stream)
+				sort_and_display_files(subdnp, nfiles);
 
 			if (ENABLE_FEATURE_LS_RECURSIVE
 			 && (G.all_fmt & DISP_RECURSIVE)
@@ -1083,10 +1149,11 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 	struct dnode **dnp;
 	struct dnode *dn;
 	struct dnode *cur;
-	unsigned opt;
+	uint64_t opt;
 	unsigned nfiles;
 	unsigned dnfiles;
 	unsigned dndirs;
+	unsigned sort_opts;
 	unsigned i;
 #if ENABLE_FEATURE_LS_COLOR
 	/* colored LS support by JaWi, janwillem.janssen@lxtreme.nl */
@@ -1139,7 +1206,7 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 		IF_FEATURE_LS_TIMESTAMPS(":c-u:u-c") /* mtime/atime */
 		/* -w NUM: */
 		IF_FEATURE_AUTOWIDTH(":w+");
-	opt = getopt32(argv, ls_options
+	opt = getopt64(argv, ls_options
 		IF_FEATURE_AUTOWIDTH(, NULL, &G_terminal_width)
 		IF_FEATURE_LS_COLOR(, &color_opt)
 	);
@@ -1157,6 +1224,11 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 			G.all_fmt |= flags;
 		}
 	}
+	/* -f and -U are past opt_flags[], they override other sort options */
+	if (opt & OPT_f)
+		G.all_fmt |= DISP_HIDDEN | DISP_DOT;
+	if (opt & (OPT_f | OPT_U))
+		G.all_fmt = (G.all_fmt & ~SORT_MASK) | SORT_NONE;
 
 #if ENABLE_FEATURE_LS_COLOR
 	/* set G_show_color = 1/0 */
@@ -1186,7 +1258,10 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 	/* sort out which command line options take precedence */
 	if (ENABLE_FEATURE_LS_RECURSIVE && (G.all_fmt & DISP_NOLIST))
 		G.all_fmt &= ~DISP_RECURSIVE;	/* no recurse if listing only dir */
-	if (ENABLE_FEATURE_LS_TIMESTAMPS && ENABLE_FEATURE_LS_SORTFILES) {
+	sort_opts = G.all_fmt & SORT_MASK;
+	if (ENABLE_FEATURE_LS_TIMESTAMPS && ENABLE_FEATURE_LS_SORTFILES
+	 && sort_opts != SORT_NONE
+	) {
 		if (G.all_fmt & TIME_CHANGE)
 			G.all_fmt = (G.all_fmt & ~SORT_MASK) | SORT_CTIME;
 		if (G.all_fmt & TIME_ACCESS)
@@ -1199,6 +1274,26 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 	if (!(G.all_fmt & STYLE_MASK))
 		G.all_fmt |= (isatty(STDOUT_FILENO) ? STYLE_COLUMNAR : STYLE_SINGLE);
 
+	/* Unsorted, one name per line: no need to read whole dir first */
+	sort_opts = G.all_fmt & SORT_MASK;
+	if ((!ENABLE_FEATURE_LS_SORTFILES || sort_opts == SORT_NONE)
+	 && (G.all_fmt & STYLE_MASK) == STYLE_SINGLE
+	) {
+		G.stream = 1;
+	}
+	/* Only name and file type needed? readdir gives us both */
+	if (!(G.all_fmt & (LIST_MASK & ~LIST_FILETYPE))
+	 && !G_show_color
+	 && !(option_mask32 & OPT_L)
+	) {
+		if (sort_opts == SORT_NAME || sort_opts == SORT_NONE
+		 || sort_opts == SORT_EXT || sort_opts == SORT_VERSION
+		 || sort_opts == SORT_DIR
+		) {
+			G.no_stat = 1;
+		}
+	}
+
 	argv += optind;
 	if (!argv[0])
 		*--argv = (char*)".";
@@ -1237,11 +1332,10 @@ int ls_main(int argc UNUSED_PARAM, char **argv)
 	 * allocate memory for an array to hold dnode pointers
 	 */
 	dnp = dnalloc(nfiles);
-	for (i = 0; /* i < nfiles - detected via !dn below */; i++) {
-		dnp[i] = dn;	/* save pointer to node in array */
+	/* list is in reverse order, fill array from the end */
+	for (i = nfiles; i != 0; ) {
+		dnp[--i] = dn;	/* save pointer to node in array */
 		dn = dn->dn_next;
-		if (!dn)
-			break;
 	}
 
 	if (G.all_fmt & DISP_NOLIST) {
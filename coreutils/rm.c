@@ -49,6 +49,10 @@ int rm_main(int argc UNUSED_PARAM, char **argv)
 		flags |= FILEUTILS_RECUR;
 
 	if (*argv != NULL) {
+		/* Not when run as NOFORK: threads must not outlive us
+		 * if we die, and the shell may fork later */
+		if ((flags & FILEUTILS_RECUR) && !running_nofork)
+			tree_readahead_start(argv);
 		do {
 			const char *base = bb_get_last_path_component_strip(*argv);
 
@@ -59,6 +63,9 @@ int rm_main(int argc UNUSED_PARAM, char **argv)
 			}
 			status = 1;
 		} while (*++argv);
+		/* A NOFORK rm must not stop its caller's (find's) readahead */
+		if ((flags & FILEUTILS_RECUR) && !running_nofork)
+			tree_readahead_stop();
 	} else if (!(flags & FILEUTILS_FORCE)) {
 		bb_show_usage();
 	}
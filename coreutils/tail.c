@@ -49,6 +49,9 @@
 //usage:       "nameserver 10.0.0.1\n"
 
 #include "libbb.h"
+#if ENABLE_FEATURE_TAIL_INOTIFY
+# include <sys/inotify.h>
+#endif
 
 static const struct suffix_mult tail_suffixes[] = {
 	{ "b", 512 },
@@ -60,6 +63,13 @@ static const struct suffix_mult tail_suffixes[] = {
 struct globals {
 	bool from_top;
 	bool exitcode;
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	int inotify_fd;
+	unsigned poll_ms;   /* -s SEC */
+	unsigned last_poll; /* monotonic_ms() of last check of all files */
+	int *wd;            /* [2*i]: file i, [2*i+1]: its directory (-F) */
+	char *ready;        /* [i]: file i may have changed */
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)&bb_common_bufsiz1)
 #define INIT_G() do { } while (0)
@@ -94,6 +104,106 @@ static ssize_t tail_read(int fd, char *buf, size_t count)
 
 #define header_fmt_str "\n==> %s <==\n"
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+/* (Re)start watching file i.
+ * -f follows the open file, so we watch its inode.
+ * -F follows the name: watch the file under this name (if any)
+ * and the directory, where the name may appear again.
+ */
+static void tail_watch(unsigned i, const char *filename, int fd, int retry)
+{
+	int *wd = &G.wd[2 * i];
+	struct stat sbuf;
+
+	/* A stale watch on a rotated away file, if any, is harmless:
+	 * it only makes us read this file once more for nothing */
+	wd[0] = wd[1] = -1;
+	if (G.inotify_fd < 0)
+		return;
+	if (fd >= 0) {
+		/* /proc files, pipes etc don't report writes, they are polled */
+		if (fstat(fd, &sbuf) != 0 || !S_ISREG(sbuf.st_mode))
+			return;
+		if (retry) {
+			wd[0] = inotify_add_watch(G.inotify_fd, filename,
+				IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+		} else {
+			char path[sizeof("/proc/self/fd/%u") + sizeof(int)*3];
+			sprintf(path, "/proc/self/fd/%u", fd);
+			wd[0] = inotify_add_watch(G.inotify_fd, path, IN_MODIFY);
+		}
+	}
+	if (retry) {
+		char *dir = xstrdup(filename);
+		/* Other files may have the same dir: do not clobber their mask */
+		wd[1] = inotify_add_watch(G.inotify_fd, dirname(dir),
+			IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD);
+		free(dir);
+	}
+}
+
+/* Sleep until some files may have new data, mark them in G.ready[] */
+static void tail_wait(char **argv, unsigned nfiles)
+{
+	struct pollfd pfd;
+	unsigned i;
+	int timeout = -1;
+
+	memset(G.ready, 0, nfiles);
+	for (i = 0; i < nfiles; i++) {
+		if (G.wd[2*i] < 0 && G.wd[2*i + 1] < 0) {
+			/* Some files must be polled */
+			unsigned elapsed = (unsigned)monotonic_ms() - G.last_poll;
+			timeout = 0;
+			if (elapsed < G.poll_ms)
+				timeout = G.poll_ms - elapsed;
+			break;
+		}
+	}
+
+	pfd.fd = G.inotify_fd; /* if < 0, poll just sleeps */
+	pfd.events = POLLIN;
+	if (safe_poll(&pfd, 1, timeout) > 0) {
+		union {
+			struct inotify_event ie;
+			char buf[4 * 1024];
+		} u;
+		char *p = u.buf;
+		ssize_t len = safe_read(G.inotify_fd, u.buf, sizeof(u.buf));
+
+		while (len >= (ssize_t)sizeof(u.ie)) {
+			struct inotify_event *ie = (void*)p;
+			unsigned sz = sizeof(*ie) + ie->len;
+
+			if (ie->mask & IN_Q_OVERFLOW)
+				memset(G.ready, 1, nfiles);
+			for (i = 0; i < nfiles; i++) {
+				int *wd = &G.wd[2 * i];
+				if (ie->wd == wd[0]) {
+					G.ready[i] = 1;
+				} else if (ie->wd == wd[1]) {
+					/* Directory event: is it our name? */
+					if (ie->len == 0 || strcmp(ie->name, bb_basename(argv[i])) == 0)
+						G.ready[i] = 1;
+				} else
+					continue;
+				if (ie->mask & IN_IGNORED) /* watch is gone */
+					wd[ie->wd == wd[1]] = -1;
+			}
+			p += sz;
+			len -= sz;
+		}
+	}
+
+	if (timeout >= 0
+	 && (unsigned)monotonic_ms() - G.last_poll >= G.poll_ms
+	) {
+		memset(G.ready, 1, nfiles);
+		G.last_poll = monotonic_ms();
+	}
+}
+#endif
+
 static unsigned eat_num(const char *p)
 {
 	if (*p == '-')
@@ -329,8 +439,28 @@ int tail_main(int argc, char **argv)
 
 	fmt = NULL;
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	if (FOLLOW) {
+		G.inotify_fd = inotify_init();
+		if (G.inotify_fd >= 0)
+			close_on_exec_on(G.inotify_fd);
+		G.poll_ms = sleep_period * 1000;
+		if (sleep_period > INT_MAX / 1000)
+			G.poll_ms = INT_MAX;
+		G.last_poll = monotonic_ms();
+		G.wd = xmalloc(sizeof(G.wd[0]) * 2 * nfiles);
+		G.ready = xmalloc(nfiles);
+		for (i = 0; i < nfiles; i++)
+			tail_watch(i, argv[i], fds[i], FOLLOW_RETRY);
+	}
+#endif
+
 	if (FOLLOW) while (1) {
+#if ENABLE_FEATURE_TAIL_INOTIFY
+		tail_wait(argv, nfiles);
+#else
 		sleep(sleep_period);
+#endif
 
 		i = 0;
 		do {
@@ -338,6 +468,10 @@ int tail_main(int argc, char **argv)
 			const char *filename = argv[i];
 			int fd = fds[i];
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+			if (!G.ready[i])
+				continue;
+#endif
 			if (FOLLOW_RETRY) {
 				struct stat sbuf, fsbuf;
 
@@ -360,6 +494,9 @@ int tail_main(int argc, char **argv)
 						bb_perror_msg("%s has become inaccessible", filename);
 					}
 					fds[i] = fd = new_fd;
+#if ENABLE_FEATURE_TAIL_INOTIFY
+					tail_watch(i, filename, fd, 1);
+#endif
 				}
 			}
 			if (ENABLE_FEATURE_FANCY_TAIL && fd < 0)
@@ -336,7 +336,7 @@ int tr_main(int argc UNUSED_PARAM, char **argv)
 		str2[out_index++] = last = coded;
 	}
 
-	if (ENABLE_FEATURE_CLEAN_UP) {
+	if (ENABLE_FEATURE_CLEAN_UP || running_nofork) {
 		free(vector);
 		free(str2);
 		free(str1);
@@ -70,7 +70,8 @@ typedef struct var_s {
 	double number;
 	char *string;
 	union {
-		int aidx;               /* func arg idx (for compilation stage) */
+		int aidx;               /* func arg idx (for compilation stage),
+		                         * field idx for $N vars */
 		struct xhash_s *array;  /* array ptr */
 		struct var_s *parent;   /* for func args, ptr to actual parameter */
 		walker_list *walker;    /* list of array elements (for..in) */
@@ -106,16 +107,25 @@ typedef struct hash_item_s {
 		struct rstream_s rs;    /* redirect streams hash */
 		struct func_s f;        /* functions hash */
 	} data;
-	struct hash_item_s *next;       /* next in chain */
 	char name[1];                   /* really it's longer */
 } hash_item;
 
+/* Open addressing with linear probing. Slots point into items[],
+ * which holds the items in insertion order: walking a hash is a plain
+ * scan of it. Items themselves never move (pointers to their data
+ * are handed out), only the slots and items[] entries do */
+typedef struct hash_slot_s {
+	unsigned hval;                  /* cached hashidx(name) */
+	unsigned idx;                   /* items[idx-1]; 0: slot is free */
+} hash_slot;
+
 typedef struct xhash_s {
 	unsigned nel;           /* num of elements */
-	unsigned csize;         /* current hash size */
-	unsigned nprime;        /* next hash size in PRIMES[] */
+	unsigned csize;         /* current hash size, power of 2 */
 	unsigned glen;          /* summary length of item names */
-	struct hash_item_s **items;
+	unsigned nused;         /* items[] used so far, deleted ones are NULL */
+	struct hash_slot_s *slots;
+	struct hash_item_s **items; /* csize / 4 * 3 of them */
 } xhash;
 
 /* Tree node */
@@ -409,9 +419,8 @@ static const char vValues[] ALIGN1 =
 	"\n\0"      "\n\0"      "\0"        "\0"
 	"\034\0"    "\0"        "\377";
 
-/* hash size may grow to these values */
-#define FIRST_PRIME 61
-static const uint16_t PRIMES[] ALIGN2 = { 251, 1021, 4093, 16381, 65521 };
+/* initial hash size, it doubles when 3/4 full */
+#define FIRST_HASH_SIZE 64
 
 
 /* Globals. Split in two parts so that first one is addressed
@@ -430,7 +439,7 @@ struct globals {
 	int g_lineno;
 	int nfields;
 	int maxfields; /* used in fsrealloc() only */
-	var *Fields;
+	var **Fields;
 	nvblock *g_cb;
 	char *g_pos;
 	char *g_buf;
@@ -451,6 +460,8 @@ struct globals2 {
 
 	/* former statics from various functions */
 	char *split_f0__fstrings;
+	char *split_f0__next;
+	char split_f0__seps[4];
 
 	uint32_t next_token__save_tclass;
 	uint32_t next_token__save_info;
@@ -555,11 +566,14 @@ static void syntax_error(const char *message)
 
 static unsigned hashidx(const char *name)
 {
-	unsigned idx = 0;
+	/* FNV-1a: table size is a power of 2, so low bits must be good */
+	unsigned idx = 2166136261U;
 
-	while (*name)
-		idx = *name++ + (idx << 6) - idx;
-	return idx;
+	while (*name) {
+		idx ^= (unsigned char)*name++;
+		idx *= 16777619;
+	}
+	return idx ^ (idx >> 16);
 }
 
 /* create new hash */
@@ -568,73 +582,98 @@ static xhash *hash_init(void)
 	xhash *newhash;
 
 	newhash = xzalloc(sizeof(*newhash));
-	newhash->csize = FIRST_PRIME;
-	newhash->items = xzalloc(FIRST_PRIME * sizeof(newhash->items[0]));
+	newhash->csize = FIRST_HASH_SIZE;
+	newhash->slots = xzalloc(FIRST_HASH_SIZE * sizeof(newhash->slots[0]));
+	newhash->items = xmalloc(FIRST_HASH_SIZE / 4 * 3 * sizeof(newhash->items[0]));
 
 	return newhash;
 }
 
+/* find slot holding name, or free slot where it should go */
+static hash_slot *hash_lookup(xhash *hash, const char *name, unsigned hval)
+{
+	unsigned mask = hash->csize - 1;
+	unsigned i = hval & mask;
+	hash_slot *hs;
+
+	while ((hs = &hash->slots[i])->idx != 0) {
+		if (hs->hval == hval
+		 && strcmp(hash->items[hs->idx - 1]->name, name) == 0
+		) {
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	return hs;
+}
+
 /* find item in hash, return ptr to data, NULL if not found */
 static void *hash_search(xhash *hash, const char *name)
 {
-	hash_item *hi;
+	hash_slot *hs;
 
-	hi = hash->items[hashidx(name) % hash->csize];
-	while (hi) {
-		if (strcmp(hi->name, name) == 0)
-			return &hi->data;
-		hi = hi->next;
-	}
-	return NULL;
+	hs = hash_lookup(hash, name, hashidx(name));
+	return hs->idx ? &hash->items[hs->idx - 1]->data : NULL;
 }
 
-/* grow hash if it becomes too big */
+/* called when items[] is full: drop deleted items from it,
+ * grow hash if it still is too full, and index the items anew */
 static void hash_rebuild(xhash *hash)
 {
-	unsigned newsize, i, idx;
-	hash_item **newitems, *hi, *thi;
-
-	if (hash->nprime == ARRAY_SIZE(PRIMES))
-		return;
+	unsigned mask, i, n, idx, hval;
+	hash_item *hi;
 
-	newsize = PRIMES[hash->nprime++];
-	newitems = xzalloc(newsize * sizeof(newitems[0]));
+	if (hash->nel >= hash->csize / 2) {
+		hash->csize *= 2;
+		free(hash->slots);
+		hash->slots = xmalloc(hash->csize * sizeof(hash->slots[0]));
+		hash->items = xrealloc(hash->items, hash->csize / 4 * 3 * sizeof(hash->items[0]));
+	}
+	memset(hash->slots, 0, hash->csize * sizeof(hash->slots[0]));
 
-	for (i = 0; i < hash->csize; i++) {
+	mask = hash->csize - 1;
+	n = 0;
+	for (i = 0; i < hash->nused; i++) {
 		hi = hash->items[i];
-		while (hi) {
-			thi = hi;
-			hi = thi->next;
-			idx = hashidx(thi->name) % newsize;
-			thi->next = newitems[idx];
-			newitems[idx] = thi;
-		}
+		if (!hi)
+			continue;
+		hash->items[n++] = hi;
+		hval = hashidx(hi->name);
+		idx = hval & mask;
+		while (hash->slots[idx].idx)
+			idx = (idx + 1) & mask;
+		hash->slots[idx].hval = hval;
+		hash->slots[idx].idx = n;
 	}
-
-	free(hash->items);
-	hash->csize = newsize;
-	hash->items = newitems;
+	hash->nused = n;
 }
 
 /* find item in hash, add it if necessary. Return ptr to data */
 static void *hash_find(xhash *hash, const char *name)
 {
+	hash_slot *hs;
 	hash_item *hi;
-	unsigned idx;
+	unsigned hval;
 	int l;
 
-	hi = hash_search(hash, name);
-	if (!hi) {
-		if (++hash->nel / hash->csize > 10)
+	hval = hashidx(name);
+	hs = hash_lookup(hash, name, hval);
+	if (hs->idx) {
+		hi = hash->items[hs->idx - 1];
+	} else {
+		if (hash->nused >= hash->csize / 4 * 3) {
 			hash_rebuild(hash);
+			hs = hash_lookup(hash, name, hval);
+		}
 
 		l = strlen(name) + 1;
 		hi = xzalloc(sizeof(*hi) + l);
 		strcpy(hi->name, name);
 
-		idx = hashidx(name) % hash->csize;
-		hi->next = hash->items[idx];
-		hash->items[idx] = hi;
+		hash->items[hash->nused++] = hi;
+		hs->hval = hval;
+		hs->idx = hash->nused;
+		hash->nel++;
 		hash->glen += l;
 	}
 	return &hi->data;
@@ -647,19 +686,36 @@ static void *hash_find(xhash *hash, const char *name)
 
 static void hash_remove(xhash *hash, const char *name)
 {
-	hash_item *hi, **phi;
+	unsigned mask = hash->csize - 1;
+	unsigned i, j, home;
+	hash_slot *hs;
 
-	phi = &hash->items[hashidx(name) % hash->csize];
-	while (*phi) {
-		hi = *phi;
-		if (strcmp(hi->name, name) == 0) {
-			hash->glen -= (strlen(name) + 1);
-			hash->nel--;
-			*phi = hi->next;
-			free(hi);
-			break;
-		}
-		phi = &hi->next;
+	hs = hash_lookup(hash, name, hashidx(name));
+	if (!hs->idx)
+		return;
+	hash->glen -= (strlen(name) + 1);
+	hash->nel--;
+	free(hash->items[hs->idx - 1]);
+	hash->items[hs->idx - 1] = NULL;
+	/* holes at the end of items[] can be reused right away,
+	 * others are dropped by hash_rebuild() */
+	while (hash->nused && !hash->items[hash->nused - 1])
+		hash->nused--;
+
+	/* no tombstones: shift back following items of the same run
+	 * which would become unreachable through the freed slot */
+	i = j = hs - hash->slots;
+	for (;;) {
+		hash->slots[i].idx = 0;
+		do {
+			j = (j + 1) & mask;
+			if (!hash->slots[j].idx)
+				return;
+			home = hash->slots[j].hval & mask;
+			/* can item at j stay where it is? (is home in (i,j]?) */
+		} while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+		hash->slots[i] = hash->slots[j];
+		i = j;
 	}
 }
 
@@ -751,19 +807,17 @@ static xhash *iamarray(var *v)
 static void clear_array(xhash *array)
 {
 	unsigned i;
-	hash_item *hi, *thi;
+	hash_item *hi;
 
-	for (i = 0; i < array->csize; i++) {
+	for (i = 0; i < array->nused; i++) {
 		hi = array->items[i];
-		while (hi) {
-			thi = hi;
-			hi = hi->next;
-			free(thi->data.v.string);
-			free(thi);
+		if (hi) {
+			free(hi->data.v.string);
+			free(hi);
 		}
-		array->items[i] = NULL;
 	}
-	array->glen = array->nel = 0;
+	memset(array->slots, 0, array->csize * sizeof(array->slots[0]));
+	array->glen = array->nel = array->nused = 0;
 }
 
 /* clear a variable */
@@ -951,6 +1005,7 @@ static void nvfree(var *v)
 	for (p = v; p < g_cb->pos; p++) {
 		if ((p->type & (VF_ARRAY | VF_CHILD)) == VF_ARRAY) {
 			clear_array(iamarray(p));
+			free(p->x.array->slots);
 			free(p->x.array->items);
 			free(p->x.array);
 		}
@@ -1628,23 +1683,30 @@ static char* qrealloc(char *b, int n, int *size)
 	return b;
 }
 
-/* resize field storage space */
+/* resize field storage space.
+ * Field variables themselves never move: $0 is split lazily,
+ * and a pointer to $1 must survive splitting out $2 later.
+ */
 static void fsrealloc(int size)
 {
 	int i;
 
 	if (size >= maxfields) {
+		var *v;
+
 		i = maxfields;
 		maxfields = size + 16;
 		Fields = xrealloc(Fields, maxfields * sizeof(Fields[0]));
-		for (; i < maxfields; i++) {
-			Fields[i].type = VF_SPECIAL;
-			Fields[i].string = NULL;
+		v = xzalloc((maxfields - i) * sizeof(*v));
+		for (; i < maxfields; i++, v++) {
+			v->type = VF_SPECIAL;
+			v->x.aidx = i;
+			Fields[i] = v;
 		}
 	}
 	/* if size < nfields, clear extra field variables */
 	for (i = size; i < nfields; i++) {
-		clrvar(Fields + i);
+		clrvar(Fields[i]);
 	}
 	nfields = size;
 }
@@ -1730,34 +1792,103 @@ static int awk_split(const char *s, node *spl, char **slist)
 	return n;
 }
 
-static void split_f0(void)
-{
-/* static char *fstrings; */
+/* static char *fstrings; - private copy of $0, fields point into it */
 #define fstrings (G.split_f0__fstrings)
+/* where splitting of $0 stopped, NULL if it's split completely */
+#define fnext    (G.split_f0__next)
+/* field separator chars $0 is being split with */
+#define fseps    (G.split_f0__seps)
+
+/* cut next field out of fstrings, in place */
+static char *next_f0_field(void)
+{
+	char *s, *e;
+
+	s = fnext;
+	if (fseps[0] == ' ') {  /* space split */
+		s = skip_whitespace(s);
+		if (!*s) {
+			fnext = NULL;
+			return NULL;
+		}
+		e = skip_non_whitespace(s);
+	} else {  /* single-character split */
+		e = fseps[1] ? strpbrk(s, fseps) : strchr(s, fseps[0]);
+		if (!e) {
+			fnext = NULL;
+			return s;
+		}
+	}
+	fnext = e;
+	if (*e)
+		*fnext++ = '\0';
+	return s;
+}
 
-	int i, n;
+/* Split $0 into (at least) n fields. Most programs look at a few
+ * leading fields only, so with space and single-char FS we stop
+ * as soon as $n is there, and continue from that point when
+ * a later field (or NF) is needed.
+ */
+static void split_f0_upto(int n)
+{
+	int i;
 	char *s;
 
-	if (is_f0_split)
-		return;
+	if (is_f0_split) {
+		if (!fnext)
+			return;
+	} else {
+		is_f0_split = TRUE;
+		free(fstrings);
+		fsrealloc(0);
+		fnext = NULL;
+		i = (char)fsplitter.n.info;
+		if ((fsplitter.n.info & OPCLSMASK) == OC_REGEXP || i == '\0') {
+			n = awk_split(getvar_s(intvar[F0]), &fsplitter.n, &fstrings);
+			fsrealloc(n);
+			s = fstrings;
+			for (i = 0; i < n; i++) {
+				Fields[i]->string = nextword(&s);
+				Fields[i]->type |= (VF_FSTR | VF_USER | VF_DIRTY);
+			}
+			goto set_nf;
+		}
+
+		fseps[0] = i;
+		fseps[1] = fseps[2] = '\0';
+		if (i != ' ') {
+			s = fseps + 1;
+			if (icase && toupper(i) != tolower(i)) {
+				fseps[0] = toupper(i);
+				*s++ = tolower(i);
+			}
+			if (*getvar_s(intvar[RS]) == '\0')
+				*s = '\n';
+		}
+		fstrings = xstrdup(getvar_s(intvar[F0]));
+		if (fstrings[0])
+			fnext = fstrings;
+	}
 
-	is_f0_split = TRUE;
-	free(fstrings);
-	fsrealloc(0);
-	n = awk_split(getvar_s(intvar[F0]), &fsplitter.n, &fstrings);
-	fsrealloc(n);
-	s = fstrings;
-	for (i = 0; i < n; i++) {
-		Fields[i].string = nextword(&s);
-		Fields[i].type |= (VF_FSTR | VF_USER | VF_DIRTY);
+	while (nfields < n && fnext) {
+		s = next_f0_field();
+		if (!s)
+			break;
+		fsrealloc(nfields + 1);
+		Fields[nfields - 1]->string = s;
+		Fields[nfields - 1]->type |= (VF_FSTR | VF_USER | VF_DIRTY);
 	}
+	if (fnext)
+		return;
 
+ set_nf:
 	/* set NF manually to avoid side effects */
 	clrvar(intvar[NF]);
 	intvar[NF]->type = VF_NUMBER | VF_SPECIAL;
 	intvar[NF]->number = nfields;
-#undef fstrings
 }
+#define split_f0() split_f0_upto(INT_MAX)
 
 /* perform additional actions when some internal variables changed */
 static void handle_special(var *v)
@@ -1773,6 +1904,7 @@ static void handle_special(var *v)
 	if (v == intvar[NF]) {
 		n = (int)getvar_i(v);
 		fsrealloc(n);
+		fnext = NULL;
 
 		/* recalculate $0 */
 		sep = getvar_s(intvar[OFS]);
@@ -1780,7 +1912,7 @@ static void handle_special(var *v)
 		b = NULL;
 		len = 0;
 		for (i = 0; i < n; i++) {
-			s = getvar_s(&Fields[i]);
+			s = getvar_s(Fields[i]);
 			l = strlen(s);
 			if (b) {
 				memcpy(b+len, sep, sl);
@@ -1808,9 +1940,11 @@ static void handle_special(var *v)
 		icase = istrue(v);
 
 	} else {				/* $n */
+		i = v->x.aidx;
+		/* need to know NF: split the rest of $0 */
+		split_f0();
 		n = getvar_i(intvar[NF]);
-		setvar_i(intvar[NF], n > v-Fields ? n : v-Fields+1);
-		/* right here v is invalid. Just to note... */
+		setvar_i(intvar[NF], n > i ? n : i+1);
 	}
 }
 
@@ -1848,12 +1982,11 @@ static void hashwalk_init(var *v, xhash *array)
 	debug_printf_walker(" walker@%p=%p\n", &v->x.walker, w);
 	w->cur = w->end = w->wbuf;
 	w->prev = prev_walker;
-	for (i = 0; i < array->csize; i++) {
+	for (i = 0; i < array->nused; i++) {
 		hi = array->items[i];
-		while (hi) {
+		if (hi) {
 			strcpy(w->end, hi->name);
 			nextword(&w->end);
-			hi = hi->next;
 		}
 	}
 }
@@ -1904,8 +2037,10 @@ static int awk_getline(rstream *rsm, var *v)
 	c = (char) rsplitter.n.info;
 	rp = 0;
 
+	/* start with a big buffer: each read() then brings in
+	 * many records, not just the tail of the current one */
 	if (!m)
-		m = qrealloc(m, 256, &size);
+		m = qrealloc(m, 16 * 1024, &size);
 
 	do {
 		b = m + a;
@@ -2851,10 +2986,10 @@ static var *evaluate(node *op, var *res)
 			if (i == 0) {
 				res = intvar[F0];
 			} else {
-				split_f0();
+				split_f0_upto(i);
 				if (i > nfields)
 					fsrealloc(i);
-				res = &Fields[i - 1];
+				res = Fields[i - 1];
 			}
 			break;
 		}
@@ -2976,13 +3111,10 @@ static int awk_exit(int r)
 	}
 
 	/* waiting for children */
-	for (i = 0; i < fdhash->csize; i++) {
+	for (i = 0; i < fdhash->nused; i++) {
 		hi = fdhash->items[i];
-		while (hi) {
-			if (hi->data.rs.F && hi->data.rs.is_pipe)
-				pclose(hi->data.rs.F);
-			hi = hi->next;
-		}
+		if (hi && hi->data.rs.F && hi->data.rs.is_pipe)
+			pclose(hi->data.rs.F);
 	}
 
 	exit(r);
@@ -74,10 +74,19 @@
  * are (in words) 2*length(file0) + length(file1) +
  * 3*(number of k-candidates installed), typically about
  * 6n words for files of length n.
+ *
+ * With -H, J is generated by Myers' O(ND) algorithm instead
+ * (E. Myers, "An O(ND) Difference Algorithm and Its Variations",
+ * Algorithmica 1, 1986), in its linear space "middle snake" form.
+ * It works on the same line hashes, in original line order,
+ * and needs 2*(n+m) words on top of them. Time is proportional
+ * to the number of differences, not to the number of matching
+ * line pairs, which is what makes stone() slow on large files
+ * with many similar lines.
  */
 
 //usage:#define diff_trivial_usage
-//usage:       "[-abBdiNqrTstw] [-L LABEL] [-S FILE] [-U LINES] FILE1 FILE2"
+//usage:       "[-abBdHiNqrTstw] [-L LABEL] [-S FILE] [-U LINES] FILE1 FILE2"
 //usage:#define diff_full_usage "\n\n"
 //usage:       "Compare files line by line and output the differences between them.\n"
 //usage:       "This implementation supports unified diffs only.\n"
@@ -85,6 +94,7 @@
 //usage:     "\n	-b	Ignore changes in the amount of whitespace"
 //usage:     "\n	-B	Ignore changes whose lines are all blank"
 //usage:     "\n	-d	Try hard to find a smaller set of changes"
+//usage:     "\n	-H	Use Myers algorithm, faster for large files"
 //usage:     "\n	-i	Ignore case differences"
 //usage:     "\n	-L	Use LABEL instead of the filename in the unified header"
 //usage:     "\n	-N	Treat absent files as empty"
@@ -130,6 +140,7 @@ enum {                  /* Commandline flags */
 	FLAG_p,         /* not implemented */
 	FLAG_B,
 	FLAG_E,         /* not implemented */
+	FLAG_H,
 };
 #define FLAG(x) (1 << FLAG_##x)
 
@@ -346,6 +357,181 @@ struct line {
 	unsigned value;
 };
 
+#define myers_eq(c, x, y) ((c)->a[(x) + 1].value == (c)->b[(y) + 1].value)
+
+struct myers {
+	const struct line *a, *b;
+	int *J;
+	int pref;
+	int *fd, *bd;   /* furthest reaching x on each diagonal k = x - y */
+	int too_expensive;
+};
+
+/* Find the midpoint of the shortest edit script
+ * for a[xoff..xlim) and b[yoff..ylim), store it in *px, *py.
+ * If the search costs too much, settle for the diagonal which
+ * got furthest (GNU diff does the same unless --minimal).
+ */
+static void myers_split(struct myers *c, int xoff, int xlim, int yoff, int ylim,
+		int *px, int *py)
+{
+	int *const fd = c->fd;
+	int *const bd = c->bd;
+	const int dmin = xoff - ylim;
+	const int dmax = xlim - yoff;
+	const int fmid = xoff - yoff;
+	const int bmid = xlim - ylim;
+	const bool odd = (fmid - bmid) & 1;
+	int fmin = fmid, fmax = fmid;
+	int bmin = bmid, bmax = bmid;
+	int cost, d;
+
+	fd[fmid] = xoff;
+	bd[bmid] = xlim;
+	for (cost = 1;; cost++) {
+		int fxybest, fxbest, bxybest, bxbest;
+
+		/* Extend the forward search by one edit */
+		if (fmin > dmin)
+			fd[--fmin - 1] = -1;
+		else
+			fmin++;
+		if (fmax < dmax)
+			fd[++fmax + 1] = -1;
+		else
+			fmax--;
+		for (d = fmax; d >= fmin; d -= 2) {
+			int x, y;
+
+			x = fd[d - 1] >= fd[d + 1] ? fd[d - 1] + 1 : fd[d + 1];
+			y = x - d;
+			while (x < xlim && y < ylim && myers_eq(c, x, y))
+				x++, y++;
+			fd[d] = x;
+			if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+				*px = x;
+				*py = y;
+				return;
+			}
+		}
+
+		/* Extend the backward search by one edit */
+		if (bmin > dmin)
+			bd[--bmin - 1] = INT_MAX;
+		else
+			bmin++;
+		if (bmax < dmax)
+			bd[++bmax + 1] = INT_MAX;
+		else
+			bmax--;
+		for (d = bmax; d >= bmin; d -= 2) {
+			int x, y;
+
+			x = bd[d - 1] < bd[d + 1] ? bd[d - 1] : bd[d + 1] - 1;
+			y = x - d;
+			while (x > xoff && y > yoff && myers_eq(c, x - 1, y - 1))
+				x--, y--;
+			bd[d] = x;
+			if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+				*px = x;
+				*py = y;
+				return;
+			}
+		}
+
+		if (cost < c->too_expensive)
+			continue;
+
+		/* Forward diagonal with the largest x + y */
+		fxybest = fxbest = -1;
+		for (d = fmax; d >= fmin; d -= 2) {
+			int x = MIN(fd[d], xlim);
+			int y = x - d;
+			if (y > ylim) {
+				x = ylim + d;
+				y = ylim;
+			}
+			if (fxybest < x + y) {
+				fxybest = x + y;
+				fxbest = x;
+			}
+		}
+		/* Backward diagonal with the smallest x + y */
+		bxybest = bxbest = INT_MAX;
+		for (d = bmax; d >= bmin; d -= 2) {
+			int x = MAX(xoff, bd[d]);
+			int y = x - d;
+			if (y < yoff) {
+				x = yoff + d;
+				y = yoff;
+			}
+			if (x + y < bxybest) {
+				bxybest = x + y;
+				bxbest = x;
+			}
+		}
+		if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+			*px = fxbest;
+			*py = fxybest - fxbest;
+		} else {
+			*px = bxbest;
+			*py = bxybest - bxbest;
+		}
+		return;
+	}
+}
+
+static void myers_compare(struct myers *c, int xoff, int xlim, int yoff, int ylim)
+{
+	int xmid, ymid;
+
+	/* Matching head and tail lines go straight into J */
+	while (xoff < xlim && yoff < ylim && myers_eq(c, xoff, yoff)) {
+		c->J[c->pref + 1 + xoff] = c->pref + 1 + yoff;
+		xoff++;
+		yoff++;
+	}
+	while (xoff < xlim && yoff < ylim && myers_eq(c, xlim - 1, ylim - 1)) {
+		xlim--;
+		ylim--;
+		c->J[c->pref + 1 + xlim] = c->pref + 1 + ylim;
+	}
+	/* Only deletions or only insertions left? J is already 0 there */
+	if (xoff == xlim || yoff == ylim)
+		return;
+
+	myers_split(c, xoff, xlim, yoff, ylim, &xmid, &ymid);
+	myers_compare(c, xoff, xmid, yoff, ymid);
+	myers_compare(c, xmid, xlim, ymid, ylim);
+}
+
+/* Fill J for lines a[1..n] of file0 and b[1..m] of file1 */
+static void myers(const struct line *a, int n, const struct line *b, int m,
+		int *J, int pref)
+{
+	struct myers c;
+	unsigned diags = n + m + 3;
+
+	c.a = a;
+	c.b = b;
+	c.J = J;
+	c.pref = pref;
+	c.fd = xmalloc(2 * diags * sizeof(c.fd[0]));
+	c.bd = c.fd + diags;
+	/* Diagonals run from -m-1 to n+1 */
+	c.fd += m + 1;
+	c.bd += m + 1;
+	c.too_expensive = INT_MAX;
+	if (!(option_mask32 & FLAG(d))) {
+		/* ~sqrt(n+m), like stone()'s bound */
+		for (c.too_expensive = 1; diags != 0; diags >>= 2)
+			c.too_expensive <<= 1;
+		c.too_expensive = MAX(4096, c.too_expensive);
+	}
+	myers_compare(&c, 0, n, 0, m);
+	free(c.fd - (m + 1));
+}
+
 static void equiv(struct line *a, int n, struct line *b, int m, int *c)
 {
 	int i = 1, j = 1;
@@ -500,13 +686,31 @@ start:
 	for (; suff < nlen[0] - pref && suff < nlen[1] - pref &&
 	       nfile[0][nlen[0] - suff].value == nfile[1][nlen[1] - suff].value;
 	       suff++);
+	J = xmalloc((nlen[0] + 2) * sizeof(J[0]));
+	/* The elements of J which fall inside the prefix and suffix regions
+	 * are marked as unchanged, while the ones which fall outside
+	 * are initialized with 0 (no matches), so that function stone can
+	 * then assign them their right values
+	 */
+	for (i = 0, delta = nlen[1] - nlen[0]; i <= nlen[0]; i++)
+		J[i] = i <= pref            ?  i :
+		       i > (nlen[0] - suff) ? (i + delta) : 0;
+	J[nlen[0] + 1] = nlen[1] + 1;
+	for (j = 0; j < 2; j++)
+		slen[j] = nlen[j] - pref - suff;
+
+	if (option_mask32 & FLAG(H)) {
+		myers(nfile[0] + pref, slen[0], nfile[1] + pref, slen[1], J, pref);
+		free(nfile[0]);
+		free(nfile[1]);
+		goto verify;
+	}
+
 	/* Arrays are pruned by the suffix and prefix length,
-	 * the result being sorted and stored in sfile[fileno],
-	 * and their sizes are stored in slen[fileno]
+	 * the result being sorted and stored in sfile[fileno]
 	 */
 	for (j = 0; j < 2; j++) {
 		sfile[j] = nfile[j] + pref;
-		slen[j] = nlen[j] - pref - suff;
 		for (i = 0; i <= slen[j]; i++)
 			sfile[j][i].serial = i;
 		qsort(sfile[j] + 1, slen[j], sizeof(*sfile[j]), line_compar);
@@ -535,22 +739,13 @@ start:
 	unsort(sfile[0], slen[0], (int *)nfile[0]);
 	class = xrealloc(class, (slen[0] + 2) * sizeof(class[0]));
 #endif
-	J = xmalloc((nlen[0] + 2) * sizeof(J[0]));
-	/* The elements of J which fall inside the prefix and suffix regions
-	 * are marked as unchanged, while the ones which fall outside
-	 * are initialized with 0 (no matches), so that function stone can
-	 * then assign them their right values
-	 */
-	for (i = 0, delta = nlen[1] - nlen[0]; i <= nlen[0]; i++)
-		J[i] = i <= pref            ?  i :
-		       i > (nlen[0] - suff) ? (i + delta) : 0;
 	/* Here the magic is performed */
 	stone(class, slen[0], member, J, pref);
-	J[nlen[0] + 1] = nlen[1] + 1;
 
 	free(class);
 	free(member);
 
+ verify:
 	/* Both files are rescanned, in an effort to find any lines
 	 * which, due to limitations intrinsic to any hashing algorithm,
 	 * are different but ended up confounded as the same
@@ -731,7 +926,7 @@ static int diffreg(char *file[2])
 		const size_t sz = COMMON_BUFSIZE / 2;
 		char *const buf0 = bb_common_bufsiz1;
 		char *const buf1 = buf0 + sz;
-		int j, k;
+		int j;
 		i = fread(buf0, 1, sz, fp[0]);
 		j = fread(buf1, 1, sz, fp[1]);
 		if (i != j) {
@@ -740,12 +935,10 @@ static int diffreg(char *file[2])
 		}
 		if (i == 0)
 			break;
-		for (k = 0; k < i; k++) {
-			if (!buf0[k] || !buf1[k])
-				binary = true;
-			if (buf0[k] != buf1[k])
-				differ = true;
-		}
+		if (!binary)
+			binary = memchr(buf0, 0, i) || memchr(buf1, 0, i);
+		if (!differ)
+			differ = (memcmp(buf0, buf1, i) != 0);
 	}
 	if (differ) {
 		if (binary && !(option_mask32 & FLAG(a)))
@@ -834,10 +1027,111 @@ static int FAST_FUNC skip_dir(const char *filename,
 	return TRUE;
 }
 
+#if BB_MMU
+/* Tells whether two regular files have the same contents */
+static bool same_regular_files(const char *path0, const char *path1, char *buf)
+{
+	enum { BUFSZ = 32 * 1024 };
+	struct stat st[2];
+	int fd0, fd1;
+	bool same = false;
+
+	fd0 = open(path0, O_RDONLY);
+	fd1 = open(path1, O_RDONLY);
+	if (fd0 < 0 || fd1 < 0
+	 || fstat(fd0, &st[0]) != 0 || fstat(fd1, &st[1]) != 0
+	 || !S_ISREG(st[0].st_mode) || !S_ISREG(st[1].st_mode)
+	 || st[0].st_size != st[1].st_size
+	) {
+		goto ret;
+	}
+	if (st[0].st_ino == st[1].st_ino && st[0].st_dev == st[1].st_dev) {
+		same = true;
+		goto ret;
+	}
+	while (1) {
+		ssize_t i = full_read(fd0, buf, BUFSZ);
+		ssize_t j = full_read(fd1, buf + BUFSZ, BUFSZ);
+		if (i != j || i < 0 || memcmp(buf, buf + BUFSZ, i) != 0)
+			break;
+		if (i == 0) {
+			same = true;
+			break;
+		}
+	}
+ ret:
+	if (fd0 >= 0)
+		close(fd0);
+	if (fd1 >= 0)
+		close(fd1);
+	return same;
+}
+
+/* Content check of all files present in both trees is the bulk of
+ * diff -r work when the trees are mostly identical. Do it up front
+ * in nproc child processes (at least two: it is mostly waiting for
+ * reads, which overlap even on one CPU). Identical pairs get their
+ * flag set in the returned (shared) array, everything else goes
+ * through diffreg() as usual, in order, in the parent.
+ */
+static char *find_same_files(char *p[2], char **common, int cnt)
+{
+	unsigned nproc;
+	char *same;
+	pid_t *pids;
+	unsigned n;
+
+	if (cnt < 64)
+		return NULL;
+	nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nproc > 8)
+		nproc = 8;
+	if (nproc < 2)
+		nproc = 2;
+	same = mmap(NULL, cnt, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANON, /* fd */ -1, /* offset */ 0);
+	if (same == MAP_FAILED)
+		return NULL;
+
+	pids = xmalloc(nproc * sizeof(pids[0]));
+	fflush_all();
+	for (n = 0; n < nproc; n++) {
+		pids[n] = fork();
+		if (pids[n] < 0) {
+			/* Not fatal, the rest is checked by diffreg() */
+			bb_perror_msg("fork");
+			break;
+		}
+		if (pids[n] == 0) {
+			char *buf = xmalloc(64 * 1024);
+			int k;
+
+			for (k = n; k < cnt; k += nproc) {
+				char *path0 = concat_path_file(p[0], common[k]);
+				char *path1 = concat_path_file(p[1], common[k]);
+				same[k] = same_regular_files(path0, path1, buf);
+				free(path0);
+				free(path1);
+			}
+			_exit(EXIT_SUCCESS);
+		}
+	}
+	while (n)
+		wait4pid(pids[--n]);
+	free(pids);
+	return same;
+}
+#endif
+
 static void diffdir(char *p[2], const char *s_start)
 {
 	struct dlist list[2];
 	int i;
+#if BB_MMU
+	char **common = NULL;
+	char *same;
+	int cnt = 0, k0;
+#endif
 
 	memset(&list, 0, sizeof(list));
 	for (i = 0; i < 2; i++) {
@@ -863,6 +1157,20 @@ static void diffdir(char *p[2], const char *s_start)
 		while (list[i].s < list[i].e && strcmp(list[i].dl[list[i].s], s_start) < 0)
 			list[i].s++;
 	}
+#if BB_MMU
+	/* Collect names present in both listings */
+	for (i = list[0].s, k0 = list[1].s; i < list[0].e && k0 < list[1].e;) {
+		int r = strcmp(list[0].dl[i], list[1].dl[k0]);
+		if (r == 0) {
+			common = xrealloc_vector(common, 6, cnt);
+			common[cnt++] = list[0].dl[i];
+		}
+		i += (r <= 0);
+		k0 += (r >= 0);
+	}
+	same = find_same_files(p, common, cnt);
+	k0 = 0;
+#endif
 	/* Now that both dirlist1 and dirlist2 contain sorted directory
 	 * listings, we can start to go through dirlist1. If both listings
 	 * contain the same file, then do a normal diff. Otherwise, behaviour
@@ -883,7 +1191,12 @@ static void diffdir(char *p[2], const char *s_start)
 			exit_status |= 1;
 		} else {
 			char *fullpath[2], *path[2]; /* if -N */
+			bool known_same = false;
 
+#if BB_MMU
+			if (pos == 0 && same)
+				known_same = same[k0++];
+#endif
 			for (i = 0; i < 2; i++) {
 				if (pos == 0 || i == k) {
 					path[i] = fullpath[i] = concat_path_file(p[i], dp[i]);
@@ -907,7 +1220,9 @@ static void diffdir(char *p[2], const char *s_start)
 					printf("File %s is a %s while file %s is a %s\n", fullpath[0], "directory", fullpath[1], "regular file");
 				else
 					printf("File %s is a %s while file %s is a %s\n", fullpath[0], "regular file", fullpath[1], "directory");
-			} else
+			} else if (known_same)
+				print_status(STATUS_SAME, fullpath);
+			else
 				print_status(diffreg(path), fullpath);
 
 			free(fullpath[0]);
@@ -920,6 +1235,11 @@ static void diffdir(char *p[2], const char *s_start)
 			list[1 - k].s++;
 		}
 	}
+#if BB_MMU
+	if (same)
+		munmap(same, cnt);
+	free(common);
+#endif
 	if (ENABLE_FEATURE_CLEAN_UP) {
 		free(list[0].dl);
 		free(list[1].dl);
@@ -946,6 +1266,7 @@ static const char diff_longopts[] ALIGN1 =
 	"report-identical-files\0"   No_argument       "s"
 	"starting-file\0"            Required_argument "S"
 	"minimal\0"                  No_argument       "d"
+	"speed-large-files\0"        No_argument       "H"
 	;
 #endif
 
@@ -963,7 +1284,7 @@ int diff_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_DIFF_LONG_OPTIONS
 	applet_long_options = diff_longopts;
 #endif
-	getopt32(argv, "abdiL:NqrsS:tTU:wupBE",
+	getopt32(argv, "abdiL:NqrsS:tTU:wupBEH",
 			&L_arg, &s_start, &opt_U_context);
 	argv += optind;
 	while (L_arg)
@@ -57,12 +57,15 @@
  */
 
 //usage:#define sed_trivial_usage
-//usage:       "[-inr] [-f FILE]... [-e CMD]... [FILE]...\n"
-//usage:       "or: sed [-inr] CMD [FILE]..."
+//usage:       "[-inr] "USE_FOR_MMU("[-P N] ")"[-f FILE]... [-e CMD]... [FILE]...\n"
+//usage:       "or: sed [-inr] "USE_FOR_MMU("[-P N] ")"CMD [FILE]..."
 //usage:#define sed_full_usage "\n\n"
 //usage:       "	-e CMD	Add CMD to sed commands to be executed"
 //usage:     "\n	-f FILE	Add FILE contents to sed commands to be executed"
 //usage:     "\n	-i	Edit files in-place (else sends result to stdout)"
+//usage:	USE_FOR_MMU(
+//usage:     "\n	-P N	With -i, edit up to N files in parallel"
+//usage:	)
 //usage:     "\n	-n	Suppress automatic printing of pattern space"
 //usage:     "\n	-r	Use extended regex syntax"
 //usage:     "\n"
@@ -85,6 +88,7 @@
 
 enum {
 	OPT_in_place = 1 << 0,
+	OPT_parallel = (1 << 5) * BB_MMU,
 };
 
 /* Each sed command turns into one of these structures. */
@@ -96,6 +100,7 @@ typedef struct sed_cmd_s {
 	regex_t *beg_match;     /* sed -e '/match/cmd' */
 	regex_t *end_match;     /* sed -e '/match/,/end_match/cmd' */
 	regex_t *sub_match;     /* For 's/sub_match/string/' */
+	char *sub_literal;      /* sub_match as a plain string, if it is one */
 	int beg_line;           /* 'sed 1p'   0 == apply commands to all lines */
 	int beg_line_orig;      /* copy of the above, needed for -i */
 	int end_line;           /* 'sed 1,3p' 0 == one line only. -1 = last line ($) */
@@ -123,11 +128,16 @@ struct globals {
 	int be_quiet, regex_type;
 	FILE *nonstdout;
 	char *outname, *hold_space;
+	char *outbuf;           /* -i: stdio buffer for the temp file */
 
 	/* List of input files */
 	int input_file_count, current_input_file;
 	FILE **input_file_list;
 
+	/* Input is read in big blocks, lines are cut out of this buffer */
+	char *rbuf;
+	unsigned rbuf_pos, rbuf_end;
+
 	regmatch_t regmatch[10];
 	regex_t *previous_regex_ptr;
 
@@ -179,12 +189,15 @@ static void sed_free_and_close_stuff(void)
 			regfree(sed_cmd->sub_match);
 			free(sed_cmd->sub_match);
 		}
+		free(sed_cmd->sub_literal);
 		free(sed_cmd->string);
 		free(sed_cmd);
 		sed_cmd = sed_cmd_next;
 	}
 
 	free(G.hold_space);
+	free(G.outbuf);
+	free(G.rbuf);
 
 	while (G.current_input_file < G.input_file_count)
 		fclose(G.input_file_list[G.current_input_file++]);
@@ -439,6 +452,14 @@ static int parse_subst_cmd(sed_cmd_t *sed_cmd, const char *substr)
 		dbg("xregcomp('%s',%x)", match, cflags);
 		xregcomp(sed_cmd->sub_match, match, cflags);
 		dbg("regcomp ok");
+		/* No special chars? Then we can use strstr instead of regexec.
+		 * (We still need the regex: "s//repl/" may reuse it later) */
+		if (!(cflags & REG_ICASE)
+		 && !strpbrk(match, (cflags & REG_EXTENDED) ? "\\.[]*^$+?(){}|" : "\\.[]*^$")
+		) {
+			sed_cmd->sub_literal = match;
+			match = NULL;
+		}
 	}
 	free(match);
 
@@ -656,14 +677,21 @@ static void add_cmd(const char *cmdstr)
 
 #define PIPE_GROW 64
 
-static void pipe_putc(char c)
+static void pipe_putn(const char *s, int n)
 {
-	if (G.pipeline.idx == G.pipeline.len) {
-		G.pipeline.buf = xrealloc(G.pipeline.buf,
-				G.pipeline.len + PIPE_GROW);
-		G.pipeline.len += PIPE_GROW;
+	if (G.pipeline.idx + n > G.pipeline.len) {
+		/* grow geometrically: long lines with many matches
+		 * shouldn't cost a realloc every 64 bytes */
+		G.pipeline.len += G.pipeline.len + n + PIPE_GROW;
+		G.pipeline.buf = xrealloc(G.pipeline.buf, G.pipeline.len);
 	}
-	G.pipeline.buf[G.pipeline.idx++] = c;
+	memcpy(G.pipeline.buf + G.pipeline.idx, s, n);
+	G.pipeline.idx += n;
+}
+
+static void pipe_putc(char c)
+{
+	pipe_putn(&c, 1);
 }
 
 static void do_subst_w_backrefs(char *line, char *replace)
@@ -679,8 +707,7 @@ static void do_subst_w_backrefs(char *line, char *replace)
 				/* print out the text held in G.regmatch[backref] */
 				if (G.regmatch[backref].rm_so != -1) {
 					j = G.regmatch[backref].rm_so;
-					while (j < G.regmatch[backref].rm_eo)
-						pipe_putc(line[j++]);
+					pipe_putn(line + j, G.regmatch[backref].rm_eo - j);
 				}
 				continue;
 			}
@@ -694,8 +721,7 @@ static void do_subst_w_backrefs(char *line, char *replace)
 		/* if we find an unescaped '&' print out the whole matched text. */
 		if (replace[i] == '&') {
 			j = G.regmatch[0].rm_so;
-			while (j < G.regmatch[0].rm_eo)
-				pipe_putc(line[j++]);
+			pipe_putn(line + j, G.regmatch[0].rm_eo - j);
 			continue;
 		}
 		/* Otherwise just output the character. */
@@ -703,6 +729,24 @@ static void do_subst_w_backrefs(char *line, char *replace)
 	}
 }
 
+/* regexec() for the s command, with a shortcut for plain string patterns */
+static int subst_exec(sed_cmd_t *sed_cmd, regex_t *current_regex, const char *line, int eflags)
+{
+	const char *p;
+
+	if (!sed_cmd->sub_literal || current_regex != sed_cmd->sub_match)
+		return regexec(current_regex, line, 10, G.regmatch, eflags);
+
+	p = strstr(line, sed_cmd->sub_literal);
+	if (!p)
+		return REG_NOMATCH;
+	/* no subexpressions in a plain string: \1..\9 are unset */
+	memset(G.regmatch + 1, 0xff, sizeof(G.regmatch) - sizeof(G.regmatch[0]));
+	G.regmatch[0].rm_so = p - line;
+	G.regmatch[0].rm_eo = G.regmatch[0].rm_so + strlen(sed_cmd->sub_literal);
+	return 0;
+}
+
 static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 {
 	char *line = *line_p;
@@ -721,21 +765,19 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 
 	/* Find the first match */
 	dbg("matching '%s'", line);
-	if (REG_NOMATCH == regexec(current_regex, line, 10, G.regmatch, 0)) {
+	if (REG_NOMATCH == subst_exec(sed_cmd, current_regex, line, 0)) {
 		dbg("no match");
 		return 0;
 	}
 	dbg("match");
 
 	/* Initialize temporary output buffer. */
-	G.pipeline.buf = xmalloc(PIPE_GROW);
-	G.pipeline.len = PIPE_GROW;
+	G.pipeline.len = strlen(line) + PIPE_GROW;
+	G.pipeline.buf = xmalloc(G.pipeline.len);
 	G.pipeline.idx = 0;
 
 	/* Now loop through, substituting for matches */
 	do {
-		int i;
-
 		/* Work around bug in glibc regexec, demonstrated by:
 		 * echo " a.b" | busybox sed 's [^ .]* x g'
 		 * The match_count check is so not to break
@@ -753,14 +795,13 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 		if (sed_cmd->which_match
 		 && (sed_cmd->which_match != match_count)
 		) {
-			for (i = 0; i < G.regmatch[0].rm_eo; i++)
-				pipe_putc(*line++);
+			pipe_putn(line, G.regmatch[0].rm_eo);
+			line += G.regmatch[0].rm_eo;
 			goto next;
 		}
 
 		/* print everything before the match */
-		for (i = 0; i < G.regmatch[0].rm_so; i++)
-			pipe_putc(line[i]);
+		pipe_putn(line, G.regmatch[0].rm_so);
 
 		/* then print the substitution string */
 		do_subst_w_backrefs(line, sed_cmd->string);
@@ -778,15 +819,10 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 			break;
 
 //maybe (G.regmatch[0].rm_eo ? REG_NOTBOL : 0) instead of unconditional REG_NOTBOL?
-	} while (regexec(current_regex, line, 10, G.regmatch, REG_NOTBOL) != REG_NOMATCH);
+	} while (subst_exec(sed_cmd, current_regex, line, REG_NOTBOL) != REG_NOMATCH);
 
 	/* Copy rest of string into output pipeline */
-	while (1) {
-		char c = *line++;
-		pipe_putc(c);
-		if (c == '\0')
-			break;
-	}
+	pipe_putn(line, strlen(line) + 1);
 
 	free(*line_p);
 	*line_p = G.pipeline.buf;
@@ -828,6 +864,60 @@ static void add_input_file(FILE *file)
 	G.input_file_list[G.input_file_count++] = file;
 }
 
+enum { RBUF_SIZE = 64 * 1024 };
+
+/* Refill read buffer if it is empty. Returns 0 on EOF/error */
+static unsigned fill_rbuf(FILE *fp)
+{
+	if (G.rbuf_pos >= G.rbuf_end) {
+		ssize_t n;
+
+		if (!G.rbuf)
+			G.rbuf = xmalloc(RBUF_SIZE);
+		/* Not fread: it would wait for the whole block
+		 * to arrive when reading from a pipe or a tty */
+		n = safe_read(fileno(fp), G.rbuf, RBUF_SIZE);
+		G.rbuf_pos = 0;
+		G.rbuf_end = n > 0 ? n : 0;
+	}
+	return G.rbuf_end - G.rbuf_pos;
+}
+
+/* Read line up to a newline or NUL byte, inclusive,
+ * return malloc'ed char[]. length of the chunk read
+ * is stored in *lenp. NULL if EOF/error.
+ * Usually the line is found in the read buffer as a whole
+ * and this takes one memchr and one malloc per line. */
+static char *get_chunk(FILE *fp, int *lenp)
+{
+	char *line = NULL;
+	unsigned len = 0;
+
+	while (fill_rbuf(fp)) {
+		char *start = G.rbuf + G.rbuf_pos;
+		unsigned n = G.rbuf_end - G.rbuf_pos;
+		char *eol;
+
+		eol = memchr(start, '\n', n);
+		if (eol)
+			n = eol - start + 1;
+		/* NUL also ends the line */
+		eol = memchr(start, '\0', n) ? : eol;
+		if (eol)
+			n = eol - start + 1;
+		line = xrealloc(line, len + n + 1);
+		memcpy(line + len, start, n);
+		len += n;
+		G.rbuf_pos += n;
+		if (eol)
+			break;
+	}
+	if (line)
+		line[len] = '\0';
+	*lenp = len;
+	return line;
+}
+
 /* Get next line of input from G.input_file_list, flushing append buffer and
  * noting if we ran out of files without a newline on the last line we read.
  */
@@ -848,23 +938,15 @@ static char *get_next_line(char *gets_char)
 	gc = NO_EOL_CHAR;
 	while (G.current_input_file < G.input_file_count) {
 		FILE *fp = G.input_file_list[G.current_input_file];
-		/* Read line up to a newline or NUL byte, inclusive,
-		 * return malloc'ed char[]. length of the chunk read
-		 * is stored in len. NULL if EOF/error */
-		temp = bb_get_chunk_from_file(fp, &len);
+		temp = get_chunk(fp, &len);
 		if (temp) {
 			/* len > 0 here, it's ok to do temp[len-1] */
 			char c = temp[len-1];
 			if (c == '\n' || c == '\0') {
 				temp[len-1] = '\0';
 				gc = c;
-				if (c == '\0') {
-					int ch = fgetc(fp);
-					if (ch != EOF)
-						ungetc(ch, fp);
-					else
-						gc = LAST_IS_NUL;
-				}
+				if (c == '\0' && !fill_rbuf(fp))
+					gc = LAST_IS_NUL;
 			}
 			/* else we put NO_EOL_CHAR into *gets_char */
 			break;
@@ -1369,12 +1451,114 @@ static void add_cmd_block(char *cmdstr)
 	free(sv);
 }
 
+/* -i: process FILE separately, replace it with the result */
+static int edit_in_place(const char *fname)
+{
+	struct stat statbuf;
+	int nonstdoutfd;
+	FILE *file;
+	sed_cmd_t *sed_cmd;
+
+	file = fopen_or_warn(fname, "r");
+	if (!file)
+		return EXIT_FAILURE;
+	add_input_file(file);
+
+	G.outname = xasprintf("%sXXXXXX", fname);
+	nonstdoutfd = xmkstemp(G.outname);
+	G.nonstdout = xfdopen_for_write(nonstdoutfd);
+	/* Default stdio buffer is only st_blksize bytes */
+	if (!G.outbuf)
+		G.outbuf = xmalloc(RBUF_SIZE);
+	setvbuf(G.nonstdout, G.outbuf, _IOFBF, RBUF_SIZE);
+
+	/* Set permissions/owner of output file */
+	fstat(fileno(file), &statbuf);
+	/* chmod'ing AFTER chown would preserve suid/sgid bits,
+	 * but GNU sed 4.2.1 does not preserve them either */
+	fchmod(nonstdoutfd, statbuf.st_mode);
+	fchown(nonstdoutfd, statbuf.st_uid, statbuf.st_gid);
+
+	process_files();
+	if (fclose(G.nonstdout) != 0) {
+		xfunc_error_retval = 4;  /* It's what gnu sed exits with... */
+		bb_error_msg_and_die(bb_msg_write_error);
+	}
+	G.nonstdout = stdout;
+
+	/* 'q' leaves the rest of input unread, drop it */
+	while (G.current_input_file < G.input_file_count)
+		fclose(G.input_file_list[G.current_input_file++]);
+	G.rbuf_pos = G.rbuf_end = 0;
+
+	/* unlink(fname); */
+	xrename(G.outname, fname);
+	free(G.outname);
+	G.outname = NULL;
+
+	/* Re-enable disabled range matches, ranges don't span files */
+	for (sed_cmd = G.sed_cmd_head; sed_cmd; sed_cmd = sed_cmd->next) {
+		sed_cmd->beg_line = sed_cmd->beg_line_orig;
+		sed_cmd->in_match = 0;
+	}
+	return EXIT_SUCCESS;
+}
+
+#if BB_MMU
+/* Can files be edited independently, in any order?
+ * Hold space and 'w' files are shared by all input files. */
+static int files_depend_on_each_other(void)
+{
+	sed_cmd_t *sed_cmd;
+
+	for (sed_cmd = G.sed_cmd_head; sed_cmd; sed_cmd = sed_cmd->next) {
+		if (sed_cmd->sw_file || strchr("gGhHx", sed_cmd->cmd) != NULL)
+			return 1;
+	}
+	return 0;
+}
+
+/* -i -P N: N processes edit every Nth file each */
+static int edit_in_place_parallel(char **argv, unsigned nproc)
+{
+	pid_t *pids;
+	unsigned n, argc;
+	int status = EXIT_SUCCESS;
+
+	argc = 0;
+	while (argv[argc])
+		argc++;
+	if (nproc > argc)
+		nproc = argc;
+	pids = xmalloc(nproc * sizeof(pids[0]));
+	fflush_all();
+	for (n = 0; n < nproc; n++) {
+		pids[n] = xfork();
+		if (pids[n] == 0) {
+			unsigned i;
+
+			for (i = n; i < argc; i += nproc)
+				status |= edit_in_place(argv[i]);
+			exit(status);
+		}
+	}
+	while (n) {
+		int r = wait4pid(pids[--n]);
+		if (r != 0)
+			status = (r > 0 && r < 0x100) ? r : EXIT_FAILURE;
+	}
+	free(pids);
+	return status;
+}
+#endif
+
 int sed_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int sed_main(int argc UNUSED_PARAM, char **argv)
 {
 	unsigned opt;
 	llist_t *opt_e, *opt_f;
 	int status = EXIT_SUCCESS;
+	USE_FOR_MMU(unsigned nproc = 1;)
 
 	INIT_G();
 
@@ -1390,9 +1574,11 @@ int sed_main(int argc UNUSED_PARAM, char **argv)
 	/* do normal option parsing */
 	opt_e = opt_f = NULL;
 	opt_complementary = "e::f::" /* can occur multiple times */
-	                    "nn"; /* count -n */
+	                    "nn" /* count -n */
+	                    USE_FOR_MMU(":P+"); /* -P N */
 	/* -i must be first, to match OPT_in_place definition */
-	opt = getopt32(argv, "irne:f:", &opt_e, &opt_f,
+	opt = getopt32(argv, "irne:f:" USE_FOR_MMU("P:"), &opt_e, &opt_f,
+			    USE_FOR_MMU(&nproc,)
 			    &G.be_quiet); /* counter for -n */
 	//argc -= optind;
 	argv += optind;
@@ -1436,13 +1622,21 @@ int sed_main(int argc UNUSED_PARAM, char **argv)
 	} else {
 		int i;
 
+#if BB_MMU
+		if ((opt & OPT_parallel) && nproc > 1 && (opt & OPT_in_place)
+		 && !files_depend_on_each_other()
+		) {
+			return edit_in_place_parallel(argv, nproc);
+		}
+#endif
 		for (i = 0; argv[i]; i++) {
-			struct stat statbuf;
-			int nonstdoutfd;
 			FILE *file;
-			sed_cmd_t *sed_cmd;
 
-			if (LONE_DASH(argv[i]) && !(opt & OPT_in_place)) {
+			if (opt & OPT_in_place) {
+				status |= edit_in_place(argv[i]);
+				continue;
+			}
+			if (LONE_DASH(argv[i])) {
 				add_input_file(stdin);
 				process_files();
 				continue;
@@ -1453,36 +1647,6 @@ int sed_main(int argc UNUSED_PARAM, char **argv)
 				continue;
 			}
 			add_input_file(file);
-			if (!(opt & OPT_in_place)) {
-				continue;
-			}
-
-			/* -i: process each FILE separately: */
-
-			G.outname = xasprintf("%sXXXXXX", argv[i]);
-			nonstdoutfd = xmkstemp(G.outname);
-			G.nonstdout = xfdopen_for_write(nonstdoutfd);
-
-			/* Set permissions/owner of output file */
-			fstat(fileno(file), &statbuf);
-			/* chmod'ing AFTER chown would preserve suid/sgid bits,
-			 * but GNU sed 4.2.1 does not preserve them either */
-			fchmod(nonstdoutfd, statbuf.st_mode);
-			fchown(nonstdoutfd, statbuf.st_uid, statbuf.st_gid);
-
-			process_files();
-			fclose(G.nonstdout);
-			G.nonstdout = stdout;
-
-			/* unlink(argv[i]); */
-			xrename(G.outname, argv[i]);
-			free(G.outname);
-			G.outname = NULL;
-
-			/* Re-enable disabled range matches */
-			for (sed_cmd = G.sed_cmd_head; sed_cmd; sed_cmd = sed_cmd->next) {
-				sed_cmd->beg_line = sed_cmd->beg_line_orig;
-			}
 		}
 		/* Here, to handle "sed 'cmds' nonexistent_file" case we did:
 		 * if (G.current_input_file >= G.input_file_count)
@@ -279,6 +279,11 @@ struct globals {
 	smallint cmd_mode;       // 0=command  1=insert 2=replace
 	int file_modified;       // buffer contents changed (counter, not flag!)
 	int last_file_modified;  // = -1;
+	unsigned text_gen;       // bumped on every change of text[], never reset
+	unsigned lc_gen;         // line cache is valid while this == text_gen
+	int lc_off, lc_lines;    // text[0..lc_off) has lc_lines newlines
+	unsigned lc_tail_gen;    // same for the tail cache:
+	int lc_tail_len, lc_tail_lines; // last lc_tail_len bytes have lc_tail_lines NLs
 	int save_argc;           // how many file names on cmd line
 	int cmdcnt;              // repetition count
 	int rows, columns;       // the terminal screen is this size
@@ -360,6 +365,13 @@ struct globals {
 #define cmd_mode                (G.cmd_mode           )
 #define file_modified           (G.file_modified      )
 #define last_file_modified      (G.last_file_modified )
+#define text_gen                (G.text_gen           )
+#define lc_gen                  (G.lc_gen             )
+#define lc_off                  (G.lc_off             )
+#define lc_lines                (G.lc_lines           )
+#define lc_tail_gen             (G.lc_tail_gen        )
+#define lc_tail_len             (G.lc_tail_len        )
+#define lc_tail_lines           (G.lc_tail_lines      )
 #define save_argc               (G.save_argc          )
 #define cmdcnt                  (G.cmdcnt             )
 #define rows                    (G.rows               )
@@ -619,6 +631,7 @@ static int init_text_buffer(char *fn)
 	free(text);
 	text_size = size + 10240;
 	screenbegin = dot = end = text = xzalloc(text_size);
+	text_gen++; // drop line cache
 
 	if (fn != current_filename) {
 		free(current_filename);
@@ -1534,6 +1547,54 @@ static char *end_screen(void)
 	return q;
 }
 
+// count NLs in p..q, inclusive
+static int count_nl(const char *p, const char *q)
+{
+	int cnt = 0;
+
+	while (p <= q) {
+		p = memchr(p, '\n', q - p + 1);
+		if (!p)
+			break;
+		cnt++;
+		p++;
+	}
+	return cnt;
+}
+
+// Line numbers are asked for on every screen refresh (status line)
+// and jumps. Remember NL counts before and after the last line asked
+// about, so that on large files we only count lines between the old
+// and the new position. Edits which do not touch the remembered
+// parts keep them valid, see text_hole_make() and text_hole_delete().
+// [p,q) is the changed area.
+static void line_cache_carry(char *p, char *q)
+{
+	if (lc_gen == text_gen - 1 && p - text >= lc_off)
+		lc_gen = text_gen;
+	if (lc_tail_gen == text_gen - 1 && q <= end - lc_tail_len)
+		lc_tail_gen = text_gen;
+}
+
+// count NLs in start..end-1
+static int count_lines_to_end(char *start)
+{
+	char *t = end - lc_tail_len;
+	char *e = end_line(start) + 1;  // next line
+	int cnt;
+
+	if (lc_tail_gen != text_gen)
+		cnt = count_nl(e, end - 1);
+	else if (e <= t)
+		cnt = count_nl(e, t - 1) + lc_tail_lines;
+	else
+		cnt = lc_tail_lines - count_nl(t, e - 1);
+	lc_tail_gen = text_gen;
+	lc_tail_len = end - e;
+	lc_tail_lines = cnt;
+	return cnt + count_nl(start, e - 1);
+}
+
 // count line from start to stop
 static int count_lines(char *start, char *stop)
 {
@@ -1545,23 +1606,53 @@ static int count_lines(char *start, char *stop)
 		start = stop;
 		stop = q;
 	}
-	cnt = 0;
 	stop = end_line(stop);
-	while (start <= stop && start <= end - 1) {
-		start = end_line(start);
-		if (*start == '\n')
-			cnt++;
-		start++;
+	if (stop > end - 1)
+		stop = end - 1;
+	if (stop < text)
+		return 0;
+	if (start != text) {
+		if (stop == end - 1)
+			return count_lines_to_end(start);
+		return count_nl(start, stop);
+	}
+
+	q = text + lc_off;
+	if (lc_gen != text_gen) {
+		cnt = count_nl(text, stop);
+	} else if (stop >= q) {
+		cnt = lc_lines + count_nl(q, stop);
+	} else if (stop - text > q - stop) {
+		cnt = lc_lines - count_nl(stop + 1, q - 1);
+	} else {
+		cnt = count_nl(text, stop);
 	}
+	// remember the beginning of stop's line
+	lc_gen = text_gen;
+	lc_off = begin_line(stop) - text;
+	lc_lines = cnt - (*stop == '\n');
 	return cnt;
 }
 
 static char *find_line(int li)	// find begining of line #li
 {
-	char *q;
+	char *q = text;
+	int n = 0;  // NLs before q
 
-	for (q = text; li > 1; li--) {
-		q = next_line(q);
+	if (lc_gen == text_gen && lc_lines < li && lc_off < end - text) {
+		q = text + lc_off;
+		n = lc_lines;
+	}
+	for (; n < li - 1; n++) {
+		char *nl = memchr(q, '\n', end - q);
+		if (!nl || nl + 1 >= end)
+			return next_line(q);  // past the last line
+		q = nl + 1;
+	}
+	if (li > 1) {
+		lc_gen = text_gen;
+		lc_off = q - text;
+		lc_lines = n;
 	}
 	return q;
 }
@@ -1822,6 +1913,7 @@ static char *char_insert(char *p, char c) // insert the char c at 'p'
 		*p = c;
 		p++;
 		file_modified++;
+		text_gen++;
 	} else if (c == 27) {	// Is this an ESC?
 		cmd_mode = 0;
 		cmdcnt = 0;
@@ -2072,7 +2164,9 @@ static uintptr_t text_hole_make(char *p, int size)	// at "p", make a 'size' byte
 	end += size;		// adjust the new END
 	if (end >= (text + text_size)) {
 		char *new_text;
-		text_size += end - (text + text_size) + 10240;
+		// grow geometrically, pasting into a big file
+		// should not realloc it again and again
+		text_size += end - (text + text_size) + 10240 + (text_size >> 3);
 		new_text = xrealloc(text, text_size);
 		bias = (new_text - text);
 		screenbegin += bias;
@@ -2092,6 +2186,8 @@ static uintptr_t text_hole_make(char *p, int size)	// at "p", make a 'size' byte
 	memmove(p + size, p, end - size - p);
 	memset(p, ' ', size);	// clear new hole
 	file_modified++;
+	text_gen++;
+	line_cache_carry(p, p + size);
 	return bias;
 }
 
@@ -2120,11 +2216,13 @@ static char *text_hole_delete(char *p, char *q) // delete "p" through "q", inclu
 	memmove(dest, src, cnt);
  thd_atend:
 	end = end - hole_size;	// adjust the new END
+	file_modified++;
+	text_gen++;
+	line_cache_carry(dest, dest);
 	if (dest >= end)
 		dest = end - 1;	// make sure dest in below end-1
 	if (end <= text)
 		dest = end = text;	// keep pointers valid
-	file_modified++;
  thd0:
 	return dest;
 }
@@ -3594,6 +3692,7 @@ static void do_cmd(int c)
 			if (dot < end - 1) {	// make sure not last char in text[]
 				*dot++ = ' ';	// replace NL with space
 				file_modified++;
+				text_gen++;
 				while (isblank(*dot)) {	// delete leading WS
 					dot_delete();
 				}
@@ -3795,6 +3894,7 @@ static void do_cmd(int c)
 		if (*dot != '\n') {
 			*dot = c1;
 			file_modified++;
+			text_gen++;
 		}
 		end_cmd_q();	// stop adding to q
 		break;
@@ -3837,9 +3937,11 @@ static void do_cmd(int c)
 			if (islower(*dot)) {
 				*dot = toupper(*dot);
 				file_modified++;
+				text_gen++;
 			} else if (isupper(*dot)) {
 				*dot = tolower(*dot);
 				file_modified++;
+				text_gen++;
 			}
 			dot_right();
 		} while (--cmdcnt > 0);
@@ -137,6 +137,15 @@
 //config:	  Support the 'find -exec' option for executing commands based upon
 //config:	  the files matched.
 //config:
+//config:config FEATURE_FIND_EXEC_PLUS
+//config:	bool "Enable -exec ... {} +"
+//config:	default y
+//config:	depends on FEATURE_FIND_EXEC
+//config:	help
+//config:	  Support the 'find -exec CMD {} +' form, which runs CMD with
+//config:	  as many file names as fit in one command line, instead of
+//config:	  once per file.
+//config:
 //config:config FEATURE_FIND_USER
 //config:	bool "Enable -user: username/uid matching"
 //config:	default y
@@ -318,6 +327,9 @@
 //usage:     "\n	-exec CMD ARG ;	Run CMD with all instances of {} replaced by"
 //usage:     "\n			file name. Fails if CMD exits with nonzero"
 //usage:	)
+//usage:	IF_FEATURE_FIND_EXEC_PLUS(
+//usage:     "\n	-exec CMD ARG {} +	Run CMD with {} replaced by list of file names"
+//usage:	)
 //usage:	IF_FEATURE_FIND_DELETE(
 //usage:     "\n	-delete		Delete current file/directory. Turns on -depth option"
 //usage:	)
@@ -374,7 +386,14 @@ IF_FEATURE_FIND_CONTEXT(ACTS(context, security_context_t context;))
 IF_FEATURE_FIND_PAREN(  ACTS(paren, action ***subexpr;))
 IF_FEATURE_FIND_PRUNE(  ACTS(prune))
 IF_FEATURE_FIND_DELETE( ACTS(delete))
-IF_FEATURE_FIND_EXEC(   ACTS(exec,  char **exec_argv; unsigned *subst_count; int exec_argc;))
+IF_FEATURE_FIND_EXEC(   ACTS(exec,  char **exec_argv; unsigned *subst_count; int exec_argc;
+				IF_FEATURE_FIND_EXEC_PLUS(
+					/* NULL for "-exec ... ;". For "-exec ... {} +":
+					 * fixed args, then file names collected so far */
+					char **filelist;
+					int filelist_idx;
+					unsigned file_len;
+				)))
 IF_FEATURE_FIND_GROUP(  ACTS(group, gid_t gid;))
 IF_FEATURE_FIND_LINKS(  ACTS(links, char links_char; unsigned links_count;))
 
@@ -387,7 +406,9 @@ struct globals {
 	action ***actions;
 	smallint need_print;
 	smallint xdev_on;
+	IF_FEATURE_FIND_EXEC_PLUS(smallint exec_plus_failed;)
 	recurse_flags_t recurse_flags;
+	IF_FEATURE_FIND_EXEC_PLUS(unsigned max_argv_len;)
 } FIX_ALIASING;
 #define G (*(struct globals*)&bb_common_bufsiz1)
 #define INIT_G() do { \
@@ -605,7 +626,36 @@ ACTF(inum)
 }
 #endif
 #if ENABLE_FEATURE_FIND_EXEC
-ACTF(exec)
+# if ENABLE_FEATURE_FIND_EXEC_PLUS
+static unsigned exec_arg_len(const char *arg)
+{
+	/* The kernel counts both the string and the argv[] slot */
+	return strlen(arg) + 1 + sizeof(char*);
+}
+
+/* Run "-exec CMD ARGS {} +" on the file names collected so far */
+static void exec_plus(action_exec *ap)
+{
+	int i, rc;
+	int n = ap->exec_argc - 1; /* fixed args, without trailing "{}" */
+
+	ap->filelist[ap->filelist_idx] = NULL;
+	/* NOFORK applets (rm...) run right here */
+	rc = spawn_and_wait(ap->filelist);
+	if (rc < 0)
+		bb_simple_perror_msg(ap->filelist[0]);
+	if (rc != 0)
+		G.exec_plus_failed = 1;
+
+	ap->file_len = 0;
+	for (i = 0; i < n; i++)
+		ap->file_len += exec_arg_len(ap->filelist[i]);
+	while (ap->filelist_idx > n)
+		free(ap->filelist[--ap->filelist_idx]);
+}
+# endif
+
+static int do_exec(action_exec *ap, const char *fileName)
 {
 	int i, rc;
 #if ENABLE_USE_PORTABLE_CODE
@@ -626,6 +676,28 @@ ACTF(exec)
 		free(argv[i++]);
 	return rc == 0; /* return 1 if exitcode 0 */
 }
+
+ACTF(exec)
+{
+#if ENABLE_FEATURE_FIND_EXEC_PLUS
+	if (ap->filelist) {
+		unsigned len = exec_arg_len(fileName);
+
+		/* Start a new command line if this name does not fit */
+		if (ap->filelist_idx >= ap->exec_argc
+		 && ap->file_len + len > G.max_argv_len
+		) {
+			exec_plus(ap);
+		}
+		ap->filelist = xrealloc_vector(ap->filelist, 4, ap->filelist_idx);
+		ap->filelist[ap->filelist_idx++] = xstrdup(fileName);
+		ap->file_len += len;
+		/* "-exec ... +" is always true, failures affect exit code */
+		return TRUE;
+	}
+#endif
+	return do_exec(ap, fileName);
+}
 #endif
 #if ENABLE_FEATURE_FIND_USER
 ACTF(user)
@@ -722,6 +794,59 @@ ACTF(links)
 }
 #endif
 
+#if ENABLE_FEATURE_FIND_EXEC_PLUS
+/* Run all pending "-exec ... {} +" */
+static void flush_exec_plus(action ***appp)
+{
+	action **app, *ap;
+
+	while ((app = *appp++) != NULL) {
+		while ((ap = *app++) != NULL) {
+			if (ap->f == (action_fp) func_exec) {
+				action_exec *ae = (void*)ap;
+				if (ae->filelist && ae->filelist_idx >= ae->exec_argc)
+					exec_plus(ae);
+			}
+# if ENABLE_FEATURE_FIND_PAREN
+			if (ap->f == (action_fp) func_paren)
+				flush_exec_plus(((action_paren*)ap)->subexpr);
+# endif
+		}
+	}
+}
+#endif
+
+/* Do all actions look only at the name and file type? */
+static int actions_need_stat(action ***appp)
+{
+	action **app, *ap;
+
+	while ((app = *appp++) != NULL) {
+		while ((ap = *app++) != NULL) {
+#if ENABLE_FEATURE_FIND_PAREN
+			if (ap->f == (action_fp) func_paren) {
+				if (actions_need_stat(((action_paren*)ap)->subexpr))
+					return 1;
+				continue;
+			}
+#endif
+			if (ap->f != (action_fp) func_print
+			 && ap->f != (action_fp) func_name
+			 IF_FEATURE_FIND_PATH(  && ap->f != (action_fp) func_path  )
+			 IF_FEATURE_FIND_REGEX( && ap->f != (action_fp) func_regex )
+			 IF_FEATURE_FIND_PRINT0(&& ap->f != (action_fp) func_print0)
+			 IF_FEATURE_FIND_TYPE(  && ap->f != (action_fp) func_type  )
+			 IF_FEATURE_FIND_PRUNE( && ap->f != (action_fp) func_prune )
+			 IF_FEATURE_FIND_DELETE(&& ap->f != (action_fp) func_delete)
+			 IF_FEATURE_FIND_EXEC(  && ap->f != (action_fp) func_exec  )
+			) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
 static int FAST_FUNC fileAction(const char *fileName,
 		struct stat *statbuf,
 		void *userData UNUSED_PARAM,
@@ -1033,9 +1158,10 @@ static action*** parse_params(char **argv)
 					bb_error_msg_and_die(bb_msg_requires_arg, "-exec");
 				// find -exec echo Foo ">{}<" ";"
 				// executes "echo Foo >FILENAME<",
-				// find -exec echo Foo ">{}<" "+"
+				// find -exec echo Foo "{}" "+"
 				// executes "echo Foo FILENAME1 FILENAME2 FILENAME3...".
-				// TODO (so far we treat "+" just like ";")
+				// If "+" does not follow a lone "{}",
+				// we treat it just like ";".
 				if ((argv[0][0] == ';' || argv[0][0] == '+')
 				 && argv[0][1] == '\0'
 				) {
@@ -1046,6 +1172,32 @@ static action*** parse_params(char **argv)
 			}
 			if (ap->exec_argc == 0)
 				bb_error_msg_and_die(bb_msg_requires_arg, arg);
+# if ENABLE_FEATURE_FIND_EXEC_PLUS
+			if (argv[0][0] == '+'
+			 && strcmp(ap->exec_argv[ap->exec_argc - 1], "{}") == 0
+			) {
+				if (!G.max_argv_len) {
+					/* Like GNU find, use at most 128k */
+					long arg_max = 128 * 1024;
+#  if defined _SC_ARG_MAX
+					long sys_max = sysconf(_SC_ARG_MAX) - 2048;
+					if (sys_max > 0 && sys_max < arg_max)
+						arg_max = sys_max;
+#  endif
+					G.max_argv_len = arg_max;
+				}
+				/* Non-NULL filelist marks "+" mode, allocate it
+				 * even if there are no fixed args ("-exec {} +") */
+				for (i = 0; ; i++) {
+					ap->filelist = xrealloc_vector(ap->filelist, 4, i);
+					if (i == ap->exec_argc - 1)
+						break;
+					ap->filelist[i] = ap->exec_argv[i];
+					ap->file_len += exec_arg_len(ap->exec_argv[i]);
+				}
+				ap->filelist_idx = i;
+			}
+# endif
 			ap->subst_count = xmalloc(ap->exec_argc * sizeof(int));
 			i = ap->exec_argc;
 			while (i--)
@@ -1264,6 +1416,10 @@ int find_main(int argc UNUSED_PARAM, char **argv)
 	G.actions = parse_params(&argv[firstopt]);
 	argv[firstopt] = NULL;
 
+	/* "find -name '*.c'" and the like need no stat() per file */
+	if (!G.xdev_on && !actions_need_stat(G.actions))
+		G.recurse_flags |= ACTION_NO_STAT;
+
 #if ENABLE_FEATURE_FIND_XDEV
 	if (G.xdev_on) {
 		struct stat stbuf;
@@ -1282,6 +1438,14 @@ int find_main(int argc UNUSED_PARAM, char **argv)
 	}
 #endif
 
+	/* Pointless if we won't stat, or won't descend into everything */
+	if (ENABLE_FEATURE_TREE_READAHEAD
+	 && !(G.recurse_flags & ACTION_NO_STAT) && !G.xdev_on
+	 IF_FEATURE_FIND_MAXDEPTH(&& G.minmaxdepth[1] == INT_MAX)
+	) {
+		tree_readahead_start(argv);
+	}
+
 	for (i = 0; argv[i]; i++) {
 		if (!recursive_action(argv[i],
 				G.recurse_flags,/* flags */
@@ -1293,6 +1457,13 @@ int find_main(int argc UNUSED_PARAM, char **argv)
 			status = EXIT_FAILURE;
 		}
 	}
+	tree_readahead_stop();
+
+#if ENABLE_FEATURE_FIND_EXEC_PLUS
+	flush_exec_plus(G.actions);
+	if (G.exec_plus_failed)
+		status = EXIT_FAILURE;
+#endif
 
 	return status;
 }
@@ -609,7 +609,8 @@ static int grep_dir(const char *dir)
 	recursive_action(dir,
 		/* recurse=yes */ ACTION_RECURSE |
 		/* followLinks=no */
-		/* depthFirst=yes */ ACTION_DEPTHFIRST,
+		/* depthFirst=yes */ ACTION_DEPTHFIRST |
+		/* only type is needed */ ACTION_NO_STAT,
 		/* fileAction= */ file_action_grep,
 		/* dirAction= */ NULL,
 		/* userData= */ &matched,
@@ -53,6 +53,14 @@
 //config:	  Support -0: input items are terminated by a NUL character
 //config:	  instead of whitespace, and the quotes and backslash
 //config:	  are not special.
+//config:
+//config:config FEATURE_XARGS_SUPPORT_PARALLEL
+//config:	bool "Enable -P N: run up to N commands in parallel"
+//config:	default y
+//config:	depends on XARGS
+//config:	help
+//config:	  Support -P N: keep up to N invocations of the command
+//config:	  running at once (0: as many as possible).
 
 //applet:IF_XARGS(APPLET_NOEXEC(xargs, xargs, BB_DIR_USR_BIN, BB_SUID_DROP, xargs))
 
@@ -87,26 +95,24 @@ struct globals {
 	char **args;
 	const char *eof_str;
 	int idx;
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+	int running_procs;
+	int max_procs;
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)&bb_common_bufsiz1)
 #define INIT_G() do { \
 	G.eof_str = NULL; /* need to clear by hand because we are NOEXEC applet */ \
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(G.running_procs = 0;) \
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(G.max_procs = 1;) \
 } while (0)
 
 
-/*
- * This function has special algorithm.
- * Don't use fork and include to main!
- */
-static int xargs_exec(void)
+/* Convert wait4pid()-style status of a finished command
+ * to our exit code: 123 if it failed, 124 if it exited with 255
+ * (we must stop), 125 if it was killed */
+static int xargs_exit_code(int status)
 {
-	int status;
-
-	status = spawn_and_wait(G.args);
-	if (status < 0) {
-		bb_simple_perror_msg(G.args[0]);
-		return errno == ENOENT ? 127 : 126;
-	}
 	if (status == 255) {
 		bb_error_msg("%s: exited with status 255; aborting", G.args[0]);
 		return 124;
@@ -121,6 +127,63 @@ static int xargs_exec(void)
 	return 0;
 }
 
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+/* Wait for any one of our running commands */
+static int xargs_wait_one(void)
+{
+	int status;
+
+	if (safe_waitpid(-1, &status, 0) < 0) {
+		/* ECHILD: they are all gone already */
+		G.running_procs = 0;
+		return 0;
+	}
+	G.running_procs--;
+	if (WIFSIGNALED(status))
+		status = WTERMSIG(status) + 0x180;
+	else
+		status = WEXITSTATUS(status);
+	return xargs_exit_code(status);
+}
+#endif
+
+/*
+ * This function has special algorithm.
+ * Don't use fork and include to main!
+ */
+static int xargs_exec(void)
+{
+	int status;
+
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+	if (G.max_procs != 1) {
+		int rc = 0;
+
+		/* Wait for a free slot. Returns exit code of the command
+		 * which freed it, or of the one we fail to start */
+		if (G.max_procs != 0 && G.running_procs >= G.max_procs) {
+			rc = xargs_wait_one();
+			if (rc > 123)
+				return rc; /* do not start new ones */
+		}
+		/* spawn() does not return until child has exec'ed
+		 * (or failed to), args[] and buf[] can be reused */
+		if (spawn(G.args) < 0) {
+			bb_simple_perror_msg(G.args[0]);
+			return errno == ENOENT ? 127 : 126;
+		}
+		G.running_procs++;
+		return rc;
+	}
+#endif
+	status = spawn_and_wait(G.args);
+	if (status < 0) {
+		bb_simple_perror_msg(G.args[0]);
+		return errno == ENOENT ? 127 : 126;
+	}
+	return xargs_exit_code(status);
+}
+
 /* In POSIX/C locale isspace is only these chars: "\t\n\v\f\r" and space.
  * "\t\n\v\f\r" happen to have ASCII codes 9,10,11,12,13.
  */
@@ -363,6 +426,9 @@ static int xargs_ask_confirmation(void)
 //usage:	IF_FEATURE_XARGS_SUPPORT_TERMOPT(
 //usage:     "\n	-x	Exit if size is exceeded"
 //usage:	)
+//usage:	IF_FEATURE_XARGS_SUPPORT_PARALLEL(
+//usage:     "\n	-P N	Run up to N PROGs in parallel"
+//usage:	)
 //usage:#define xargs_example_usage
 //usage:       "$ ls | xargs gzip\n"
 //usage:       "$ find . -name '*.c' -print | xargs rm\n"
@@ -378,6 +444,7 @@ enum {
 	IF_FEATURE_XARGS_SUPPORT_CONFIRMATION(OPTBIT_INTERACTIVE,)
 	IF_FEATURE_XARGS_SUPPORT_TERMOPT(     OPTBIT_TERMINATE  ,)
 	IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   OPTBIT_ZEROTERM   ,)
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(    OPTBIT_MAX_PROCS  ,)
 
 	OPT_VERBOSE     = 1 << OPTBIT_VERBOSE    ,
 	OPT_NO_EMPTY    = 1 << OPTBIT_NO_EMPTY   ,
@@ -388,11 +455,13 @@ enum {
 	OPT_INTERACTIVE = IF_FEATURE_XARGS_SUPPORT_CONFIRMATION((1 << OPTBIT_INTERACTIVE)) + 0,
 	OPT_TERMINATE   = IF_FEATURE_XARGS_SUPPORT_TERMOPT(     (1 << OPTBIT_TERMINATE  )) + 0,
 	OPT_ZEROTERM    = IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   (1 << OPTBIT_ZEROTERM   )) + 0,
+	OPT_MAX_PROCS   = IF_FEATURE_XARGS_SUPPORT_PARALLEL(    (1 << OPTBIT_MAX_PROCS  )) + 0,
 };
 #define OPTION_STR "+trn:s:e::E:" \
 	IF_FEATURE_XARGS_SUPPORT_CONFIRMATION("p") \
 	IF_FEATURE_XARGS_SUPPORT_TERMOPT(     "x") \
-	IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   "0")
+	IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(   "0") \
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(    "P:")
 
 int xargs_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int xargs_main(int argc, char **argv)
@@ -401,6 +470,7 @@ int xargs_main(int argc, char **argv)
 	int child_error = 0;
 	char *max_args;
 	char *max_chars;
+	IF_FEATURE_XARGS_SUPPORT_PARALLEL(char *max_procs;)
 	char *buf;
 	unsigned opt;
 	int n_max_chars;
@@ -419,7 +489,8 @@ int xargs_main(int argc, char **argv)
 		"no-run-if-empty\0" No_argument "r"
 		;
 #endif
-	opt = getopt32(argv, OPTION_STR, &max_args, &max_chars, &G.eof_str, &G.eof_str);
+	opt = getopt32(argv, OPTION_STR, &max_args, &max_chars, &G.eof_str, &G.eof_str
+			IF_FEATURE_XARGS_SUPPORT_PARALLEL(, &max_procs));
 
 	/* -E ""? You may wonder why not just omit -E?
 	 * This is used for portability:
@@ -430,6 +501,11 @@ int xargs_main(int argc, char **argv)
 	if (opt & OPT_ZEROTERM)
 		IF_FEATURE_XARGS_SUPPORT_ZERO_TERM(read_args = process0_stdin);
 
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+	if (opt & OPT_MAX_PROCS)
+		G.max_procs = xatou_range(max_procs, 0, INT_MAX);
+#endif
+
 	argv += optind;
 	argc -= optind;
 	if (!argv[0]) {
@@ -528,16 +604,28 @@ int xargs_main(int argc, char **argv)
 		}
 
 		if (!(opt & OPT_INTERACTIVE) || xargs_ask_confirmation()) {
-			child_error = xargs_exec();
+			/* 123 ("some command failed") must not be
+			 * reset to 0 by later successful runs */
+			int rc = xargs_exec();
+			if (child_error < rc)
+				child_error = rc;
 		}
 
-		if (child_error > 0 && child_error != 123) {
+		if (child_error > 123) {
 			break;
 		}
 
 		overlapping_strcpy(buf, rem);
 	} /* while */
 
+#if ENABLE_FEATURE_XARGS_SUPPORT_PARALLEL
+	while (G.running_procs > 0) {
+		int rc = xargs_wait_one();
+		if (child_error < rc)
+			child_error = rc;
+	}
+#endif
+
 	if (ENABLE_FEATURE_CLEAN_UP) {
 		free(G.args);
 		free(buf);
@@ -318,8 +318,11 @@ typedef off_t filesize_t;
 /* glibc uses __errno_location() to get a ptr to errno */
 /* We can just memorize it once - no multithreading in busybox :) */
 extern int *const bb_errno;
-#undef errno
-#define errno (*bb_errno)
+/* ...except for these, where each thread needs its own errno */
+# if !ENABLE_FEATURE_TREE_READAHEAD && !ENABLE_FEATURE_CP_PARALLEL
+#  undef errno
+#  define errno (*bb_errno)
+# endif
 #endif
 
 #if !(ULONG_MAX > 0xffffffff)
@@ -358,6 +361,9 @@ enum {	/* DO NOT CHANGE THESE VALUES!  cp.c, mv.c, install.c depend on them. */
 	FILEUTILS_SET_SECURITY_CONTEXT = 1 << 10,
 #endif
 	FILEUTILS_IGNORE_CHMOD_ERR = 1 << 11,
+	/* Above cp's own option bits. Set by cp --reflink[=always] */
+	FILEUTILS_REFLINK         = 1 << 20,
+	FILEUTILS_REFLINK_ALWAYS  = 1 << 21,
 };
 #define FILEUTILS_CP_OPTSTR "pdRfilsLH" IF_SELINUX("c")
 extern int remove_file(const char *path, int flags) FAST_FUNC;
@@ -366,6 +372,11 @@ extern int remove_file(const char *path, int flags) FAST_FUNC;
  * This makes "cp /dev/null file" and "install /dev/null file" (!!!)
  * work coreutils-compatibly. */
 extern int copy_file(const char *source, const char *dest, int flags) FAST_FUNC;
+#if ENABLE_FEATURE_CP_PARALLEL
+/* Between these, copy_file() leaves regular files to worker threads */
+void copy_file_parallel_start(void) FAST_FUNC;
+int copy_file_parallel_finish(void) FAST_FUNC;
+#endif
 
 enum {
 	ACTION_RECURSE        = (1 << 0),
@@ -375,12 +386,24 @@ enum {
 	/*ACTION_REVERSE      = (1 << 4), - unused */
 	ACTION_QUIET          = (1 << 5),
 	ACTION_DANGLING_OK    = (1 << 6),
+	/* Callbacks use only S_IFMT bits of statbuf->st_mode
+	 * (except on depth 0): readdir's d_type may be used instead of stat */
+	ACTION_NO_STAT        = (1 << 7),
 };
 typedef uint8_t recurse_flags_t;
 extern int recursive_action(const char *fileName, unsigned flags,
 	int FAST_FUNC (*fileAction)(const char *fileName, struct stat* statbuf, void* userData, int depth),
 	int FAST_FUNC (*dirAction)(const char *fileName, struct stat* statbuf, void* userData, int depth),
 	void* userData, unsigned depth) FAST_FUNC;
+#if ENABLE_FEATURE_TREE_READAHEAD
+/* Walk NULL-terminated list of trees in background threads, only to warm
+ * up stat/dentry caches for the "real" walk which follows */
+void tree_readahead_start(char **paths) FAST_FUNC;
+void tree_readahead_stop(void) FAST_FUNC;
+#else
+# define tree_readahead_start(paths) ((void)0)
+# define tree_readahead_stop()       ((void)0)
+#endif
 extern int device_open(const char *device, int mode) FAST_FUNC;
 enum { GETPTY_BUFSIZE = 16 }; /* more than enough for "/dev/ttyXXX" */
 extern int xgetpty(char *line) FAST_FUNC;
@@ -973,6 +996,11 @@ int wait4pid(pid_t pid) FAST_FUNC;
 int spawn_and_wait(char **argv) FAST_FUNC;
 /* Does NOT check that applet is NOFORK, just blindly runs it */
 int run_nofork_applet(int applet_no, char **argv) FAST_FUNC;
+#if ENABLE_FEATURE_PREFER_APPLETS
+extern smallint running_nofork;
+#else
+# define running_nofork 0
+#endif
 
 /* Helpers for daemonization.
  *
@@ -1041,6 +1069,7 @@ extern const char *applet_long_options;
 #endif
 extern uint32_t option_mask32;
 extern uint32_t getopt32(char **argv, const char *applet_opts, ...) FAST_FUNC;
+extern uint64_t getopt64(char **argv, const char *applet_opts, ...) FAST_FUNC;
 
 
 /* Having next pointer as a first member allows easy creation
@@ -8,6 +8,15 @@
  * Licensed under GPLv2 or later, see file LICENSE in this source tree.
  */
 #include "libbb.h"
+#if ENABLE_FEATURE_SPARSE_COPY
+# include <sys/syscall.h>
+#endif
+#if ENABLE_FEATURE_CP_PARALLEL
+# include <pthread.h>
+#endif
+#ifndef FICLONE
+# define FICLONE _IOW(0x94, 9, int)
+#endif
 
 // FEATURE_NON_POSIX_CP:
 //
@@ -67,6 +76,387 @@ static int ask_and_unlink(const char *dest, int flags)
 	return 1; /* ok (to try again) */
 }
 
+#if ENABLE_FEATURE_SPARSE_COPY
+/* Copy size bytes (0: until EOF) from current offset of src_fd
+ * to current offset of dst_fd. Try to let the kernel do it:
+ * no copying through userspace, and NFS, CIFS, btrfs, xfs
+ * can copy server-side or share extents.
+ * Returns bytes copied, or -1 (error is reported).
+ */
+static off_t copy_segment(int src_fd, int dst_fd, off_t size)
+{
+	off_t total = 0;
+	off_t r;
+
+# ifdef __NR_copy_file_range
+	while (size == 0 || total < size) {
+		size_t chunk = 1024 * 1024 * 1024;
+		ssize_t n;
+
+		if (size != 0 && size - total < chunk)
+			chunk = size - total;
+		n = syscall(__NR_copy_file_range, src_fd, NULL, dst_fd, NULL, chunk, 0);
+		/* Not supported here (old kernel, different fs, etc)? Or 0:
+		 * it may be EOF, but some pseudo-files (procfs, sysfs)
+		 * also return 0. read() will tell for sure.
+		 * On real I/O errors, read/write report them properly.
+		 */
+		if (n <= 0)
+			break;
+		total += n;
+	}
+	if (size != 0 && total == size)
+		return total;
+# endif
+	if (size == 0)
+		r = bb_copyfd_eof(src_fd, dst_fd);
+	else
+		r = bb_copyfd_size(src_fd, dst_fd, size - total);
+	return r < 0 ? -1 : total + r;
+}
+
+/* Copy regular file, keep holes. Returns 0 or -1 */
+static int copy_regular(int src_fd, int dst_fd, const struct stat *src_stat)
+{
+	struct stat dst_stat;
+	off_t pos, end;
+
+	/* Empty (maybe a pseudo-file with bogus st_size)? Just read it */
+	if (src_stat->st_size == 0)
+		return bb_copyfd_eof(src_fd, dst_fd) < 0 ? -1 : 0;
+
+	/* Not sparse, or can't make holes in dest (cp file /dev/foo)? */
+	if ((off_t)src_stat->st_blocks * 512 >= src_stat->st_size
+	 || fstat(dst_fd, &dst_stat) != 0
+	 || !S_ISREG(dst_stat.st_mode)
+	) {
+		goto plain;
+	}
+
+	pos = 0;
+	for (;;) {
+		off_t data, hole;
+
+		data = lseek(src_fd, pos, SEEK_DATA);
+		if (data < 0) {
+			if (errno == ENXIO) /* only a hole after pos */
+				break;
+			if (pos == 0) /* fs does not support SEEK_DATA */
+				goto plain;
+			goto err;
+		}
+		hole = lseek(src_fd, data, SEEK_HOLE);
+		if (hole < 0
+		 || lseek(src_fd, data, SEEK_SET) < 0
+		 || lseek(dst_fd, data, SEEK_SET) < 0
+		) {
+			goto err;
+		}
+		if (copy_segment(src_fd, dst_fd, hole - data) != hole - data)
+			return -1;
+		pos = hole;
+	}
+	/* Trailing hole */
+	end = lseek(src_fd, 0, SEEK_END);
+	if (end < 0 || ftruncate(dst_fd, end) < 0)
+		goto err;
+	return 0;
+ err:
+	bb_perror_msg("can't copy holes");
+	return -1;
+ plain:
+	return copy_segment(src_fd, dst_fd, 0) < 0 ? -1 : 0;
+}
+#endif
+
+/* Set times, owner and mode of dest as in *source_stat */
+static void preserve_status(const char *dest, struct stat *source_stat)
+{
+	struct timeval times[2];
+
+	times[1].tv_sec = times[0].tv_sec = source_stat->st_mtime;
+	times[1].tv_usec = times[0].tv_usec = 0;
+	/* BTW, utimes sets usec-precision time - just FYI */
+	if (utimes(dest, times) < 0)
+		bb_perror_msg("can't preserve %s of '%s'", "times", dest);
+	if (chown(dest, source_stat->st_uid, source_stat->st_gid) < 0) {
+		source_stat->st_mode &= ~(S_ISUID | S_ISGID);
+		bb_perror_msg("can't preserve %s of '%s'", "ownership", dest);
+	}
+	if (chmod(dest, source_stat->st_mode) < 0)
+		bb_perror_msg("can't preserve %s of '%s'", "permissions", dest);
+}
+
+/* Copy contents of source to (new) dest. Same return values as copy_file */
+static int copy_data(const char *source, const char *dest, struct stat *source_stat, int flags)
+{
+	int src_fd;
+	int dst_fd;
+	mode_t new_mode;
+	smallint retval = 0;
+	smallint ovr;
+
+	src_fd = open_or_warn(source, O_RDONLY);
+	if (src_fd < 0)
+		return -1;
+
+	/* Do not try to open with weird mode fields */
+	new_mode = source_stat->st_mode;
+	if (!S_ISREG(source_stat->st_mode))
+		new_mode = 0666;
+
+	// POSIX way is a security problem versus (sym)link attacks
+	if (!ENABLE_FEATURE_NON_POSIX_CP) {
+		dst_fd = open(dest, O_WRONLY|O_CREAT|O_TRUNC, new_mode);
+	} else { /* safe way: */
+		dst_fd = open(dest, O_WRONLY|O_CREAT|O_EXCL, new_mode);
+	}
+	if (dst_fd == -1) {
+		ovr = ask_and_unlink(dest, flags);
+		if (ovr <= 0) {
+			close(src_fd);
+			return ovr;
+		}
+		/* It shouldn't exist. If it exists, do not open (symlink attack?) */
+		dst_fd = open3_or_warn(dest, O_WRONLY|O_CREAT|O_EXCL, new_mode);
+		if (dst_fd < 0) {
+			close(src_fd);
+			return -1;
+		}
+	}
+
+#if ENABLE_SELINUX
+	if ((flags & (FILEUTILS_PRESERVE_SECURITY_CONTEXT|FILEUTILS_SET_SECURITY_CONTEXT))
+	 && is_selinux_enabled() > 0
+	) {
+		security_context_t con;
+		if (getfscreatecon(&con) == -1) {
+			bb_perror_msg("getfscreatecon");
+			return -1;
+		}
+		if (con) {
+			if (setfilecon(dest, con) == -1) {
+				bb_perror_msg("setfilecon:%s,%s", dest, con);
+				freecon(con);
+				return -1;
+			}
+			freecon(con);
+		}
+	}
+#endif
+	if (ENABLE_FEATURE_CP_REFLINK
+	 && (flags & FILEUTILS_REFLINK)
+	 && S_ISREG(source_stat->st_mode)
+	) {
+		/* Share extents with the source (btrfs, xfs, ...) */
+		if (ioctl(dst_fd, FICLONE, src_fd) == 0)
+			goto copied;
+		if (flags & FILEUTILS_REFLINK_ALWAYS) {
+			bb_perror_msg("can't clone '%s' to '%s'", source, dest);
+			retval = -1;
+			goto copied;
+		}
+	}
+#if ENABLE_FEATURE_SPARSE_COPY
+	if (S_ISREG(source_stat->st_mode)) {
+		if (copy_regular(src_fd, dst_fd, source_stat) < 0)
+			retval = -1;
+	} else
+#endif
+	if (bb_copyfd_eof(src_fd, dst_fd) == -1)
+		retval = -1;
+ copied:
+	/* Careful with writing... */
+	if (close(dst_fd) < 0) {
+		bb_perror_msg("error writing to '%s'", dest);
+		retval = -1;
+	}
+	/* ...but read size is already checked by bb_copyfd_eof */
+	close(src_fd);
+	/* "cp /dev/something new_file" should not
+	 * copy mode of /dev/something */
+	if (!S_ISREG(source_stat->st_mode))
+		return retval;
+	if (flags & FILEUTILS_PRESERVE_STATUS)
+		preserve_status(dest, source_stat);
+	return retval;
+}
+
+#if ENABLE_FEATURE_CP_PARALLEL
+/* "cp -R" with worker threads.
+ *
+ * The main thread walks the tree as usual and creates directories,
+ * links and special files itself. Contents of regular files are copied
+ * by a few threads: copy_file() just queues the file and returns.
+ * Until all queued files are written, directories keep changing,
+ * so setting their final mode (and times etc with -p) is postponed
+ * to copy_file_parallel_finish().
+ */
+# define NUM_THREADS CONFIG_FEATURE_CP_PARALLEL_THREADS
+/* Do not eat all memory on huge trees: the walk waits for workers */
+# define MAX_QUEUED  (NUM_THREADS * 64)
+
+struct cp_job {
+	struct cp_job *next;
+	struct stat st;
+	int flags;
+	int dir_mode;   /* directories: mode to set, or -1 */
+	char *dest;     /* points into source[] */
+	char source[1];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;  /* a job is queued, or stop is set */
+	pthread_cond_t done;  /* a job is finished */
+	struct cp_job *head;
+	struct cp_job **tail;
+	unsigned pending;     /* queued or being copied */
+	unsigned nthreads;
+	smallint stop;
+	smallint failed;
+	/* Directories to finish, children before parents.
+	 * Only the main thread uses these */
+	struct cp_job *dirs;
+	struct cp_job **dirs_tail;
+	pthread_t tid[NUM_THREADS];
+} cp_pool = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+};
+
+static struct cp_job *new_job(const char *source, const char *dest,
+		const struct stat *st, int flags)
+{
+	size_t slen = strlen(source) + 1;
+	struct cp_job *job = xmalloc(sizeof(*job) + slen + strlen(dest));
+
+	job->next = NULL;
+	job->st = *st;
+	job->flags = flags;
+	job->dest = job->source + slen;
+	memcpy(job->source, source, slen);
+	strcpy(job->dest, dest);
+	return job;
+}
+
+static void queue_copy(const char *source, const char *dest,
+		const struct stat *st, int flags)
+{
+	struct cp_job *job = new_job(source, dest, st, flags);
+
+	pthread_mutex_lock(&cp_pool.lock);
+	while (cp_pool.pending >= MAX_QUEUED)
+		pthread_cond_wait(&cp_pool.done, &cp_pool.lock);
+	*cp_pool.tail = job;
+	cp_pool.tail = &job->next;
+	cp_pool.pending++;
+	pthread_cond_signal(&cp_pool.cond);
+	pthread_mutex_unlock(&cp_pool.lock);
+}
+
+/* Wait until all queued files are written */
+static void wait_for_copies(void)
+{
+	pthread_mutex_lock(&cp_pool.lock);
+	while (cp_pool.pending)
+		pthread_cond_wait(&cp_pool.done, &cp_pool.lock);
+	pthread_mutex_unlock(&cp_pool.lock);
+}
+
+static void defer_dir(const char *dest, const struct stat *st, int flags, int dir_mode)
+{
+	struct cp_job *job = new_job("", dest, st, flags);
+
+	job->dir_mode = dir_mode;
+	*cp_pool.dirs_tail = job;
+	cp_pool.dirs_tail = &job->next;
+}
+
+static void *cp_thread(void *arg UNUSED_PARAM)
+{
+	pthread_mutex_lock(&cp_pool.lock);
+	for (;;) {
+		struct cp_job *job = cp_pool.head;
+		if (job) {
+			int r;
+
+			cp_pool.head = job->next;
+			if (!cp_pool.head)
+				cp_pool.tail = &cp_pool.head;
+			pthread_mutex_unlock(&cp_pool.lock);
+			r = copy_data(job->source, job->dest, &job->st, job->flags);
+			free(job);
+			pthread_mutex_lock(&cp_pool.lock);
+			if (r < 0)
+				cp_pool.failed = 1;
+			cp_pool.pending--;
+			pthread_cond_signal(&cp_pool.done);
+			continue;
+		}
+		if (cp_pool.stop)
+			break;
+		pthread_cond_wait(&cp_pool.cond, &cp_pool.lock);
+	}
+	pthread_mutex_unlock(&cp_pool.lock);
+	return NULL;
+}
+
+void FAST_FUNC copy_file_parallel_start(void)
+{
+	pthread_attr_t attr;
+	sigset_t all, old;
+
+	if (cp_pool.nthreads) /* already running */
+		return;
+	cp_pool.tail = &cp_pool.head;
+	cp_pool.dirs_tail = &cp_pool.dirs;
+	cp_pool.stop = 0;
+
+	/* Signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 128 * 1024);
+	while (cp_pool.nthreads < NUM_THREADS) {
+		if (pthread_create(&cp_pool.tid[cp_pool.nthreads], &attr, cp_thread, NULL) != 0)
+			break;
+		cp_pool.nthreads++;
+	}
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	/* If no thread was created, copy_file() works as usual */
+}
+
+/* Wait for queued copies, finish directories.
+ * Returns -1 if any queued copy failed */
+int FAST_FUNC copy_file_parallel_finish(void)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&cp_pool.lock);
+	cp_pool.stop = 1;
+	pthread_cond_broadcast(&cp_pool.cond);
+	pthread_mutex_unlock(&cp_pool.lock);
+
+	for (i = 0; i < cp_pool.nthreads; i++)
+		pthread_join(cp_pool.tid[i], NULL);
+	cp_pool.nthreads = 0;
+
+	while (cp_pool.dirs) {
+		struct cp_job *d = cp_pool.dirs;
+		cp_pool.dirs = d->next;
+		if (d->dir_mode >= 0 && chmod(d->dest, d->dir_mode) < 0)
+			bb_perror_msg("can't preserve %s of '%s'", "permissions", d->dest);
+		if (d->flags & FILEUTILS_PRESERVE_STATUS)
+			preserve_status(d->dest, &d->st);
+		free(d);
+	}
+	return cp_pool.failed ? -1 : 0;
+}
+#endif
+
 /* Return:
  * -1 error, copy not made
  *  0 copy is made or user answered "no" in interactive mode
@@ -201,6 +591,14 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 		}
 		closedir(dp);
 
+#if ENABLE_FEATURE_CP_PARALLEL
+		if (cp_pool.nthreads) {
+			/* Files may still be appearing in it */
+			defer_dir(dest, &source_stat, flags,
+				dest_exists ? -1 : (int)(source_stat.st_mode & ~saved_umask));
+			return retval;
+		}
+#endif
 		if (!dest_exists
 		 && chmod(dest, source_stat.st_mode & ~saved_umask) < 0
 		) {
@@ -239,10 +637,6 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 	  * So the below is never true: */
 	 /* || (FLAGS_DEREF && S_ISLNK(source_stat.st_mode)) */
 	) {
-		int src_fd;
-		int dst_fd;
-		mode_t new_mode;
-
 		if (!FLAGS_DEREF && S_ISLNK(source_stat.st_mode)) {
 			/* "cp -d symlink dst": create a link */
 			goto dont_cat;
@@ -252,7 +646,15 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 			const char *link_target;
 			link_target = is_in_ino_dev_hashtable(&source_stat);
 			if (link_target) {
-				if (link(link_target, dest) < 0) {
+				int r = link(link_target, dest);
+#if ENABLE_FEATURE_CP_PARALLEL
+				if (r < 0 && errno == ENOENT && cp_pool.nthreads) {
+					/* Link target may be still in the queue */
+					wait_for_copies();
+					r = link(link_target, dest);
+				}
+#endif
+				if (r < 0) {
 					ovr = ask_and_unlink(dest, flags);
 					if (ovr <= 0)
 						return ovr;
@@ -266,68 +668,13 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 			add_to_ino_dev_hashtable(&source_stat, dest);
 		}
 
-		src_fd = open_or_warn(source, O_RDONLY);
-		if (src_fd < 0)
-			return -1;
-
-		/* Do not try to open with weird mode fields */
-		new_mode = source_stat.st_mode;
-		if (!S_ISREG(source_stat.st_mode))
-			new_mode = 0666;
-
-		// POSIX way is a security problem versus (sym)link attacks
-		if (!ENABLE_FEATURE_NON_POSIX_CP) {
-			dst_fd = open(dest, O_WRONLY|O_CREAT|O_TRUNC, new_mode);
-		} else { /* safe way: */
-			dst_fd = open(dest, O_WRONLY|O_CREAT|O_EXCL, new_mode);
-		}
-		if (dst_fd == -1) {
-			ovr = ask_and_unlink(dest, flags);
-			if (ovr <= 0) {
-				close(src_fd);
-				return ovr;
-			}
-			/* It shouldn't exist. If it exists, do not open (symlink attack?) */
-			dst_fd = open3_or_warn(dest, O_WRONLY|O_CREAT|O_EXCL, new_mode);
-			if (dst_fd < 0) {
-				close(src_fd);
-				return -1;
-			}
-		}
-
-#if ENABLE_SELINUX
-		if ((flags & (FILEUTILS_PRESERVE_SECURITY_CONTEXT|FILEUTILS_SET_SECURITY_CONTEXT))
-		 && is_selinux_enabled() > 0
-		) {
-			security_context_t con;
-			if (getfscreatecon(&con) == -1) {
-				bb_perror_msg("getfscreatecon");
-				return -1;
-			}
-			if (con) {
-				if (setfilecon(dest, con) == -1) {
-					bb_perror_msg("setfilecon:%s,%s", dest, con);
-					freecon(con);
-					return -1;
-				}
-				freecon(con);
-			}
+#if ENABLE_FEATURE_CP_PARALLEL
+		if (cp_pool.nthreads && S_ISREG(source_stat.st_mode)) {
+			queue_copy(source, dest, &source_stat, flags);
+			return 0;
 		}
 #endif
-		if (bb_copyfd_eof(src_fd, dst_fd) == -1)
-			retval = -1;
-		/* Careful with writing... */
-		if (close(dst_fd) < 0) {
-			bb_perror_msg("error writing to '%s'", dest);
-			retval = -1;
-		}
-		/* ...but read size is already checked by bb_copyfd_eof */
-		close(src_fd);
-		/* "cp /dev/something new_file" should not
-		 * copy mode of /dev/something */
-		if (!S_ISREG(source_stat.st_mode))
-			return retval;
-		goto preserve_mode_ugid_time;
+		return copy_data(source, dest, &source_stat, flags);
 	}
  dont_cat:
 
@@ -374,19 +721,7 @@ int FAST_FUNC copy_file(const char *source, const char *dest, int flags)
 	/* Cannot happen: */
 	/* && !(flags & (FILEUTILS_MAKE_SOFTLINK|FILEUTILS_MAKE_HARDLINK)) */
 	) {
-		struct timeval times[2];
-
-		times[1].tv_sec = times[0].tv_sec = source_stat.st_mtime;
-		times[1].tv_usec = times[0].tv_usec = 0;
-		/* BTW, utimes sets usec-precision time - just FYI */
-		if (utimes(dest, times) < 0)
-			bb_perror_msg("can't preserve %s of '%s'", "times", dest);
-		if (chown(dest, source_stat.st_uid, source_stat.st_gid) < 0) {
-			source_stat.st_mode &= ~(S_ISUID | S_ISGID);
-			bb_perror_msg("can't preserve %s of '%s'", "ownership", dest);
-		}
-		if (chmod(dest, source_stat.st_mode) < 0)
-			bb_perror_msg("can't preserve %s of '%s'", "permissions", dest);
+		preserve_status(dest, &source_stat);
 	}
 
 	return retval;
@@ -290,6 +290,13 @@ Special characters:
         a '-2' option then unset '-3', '-X' and '-a'; if there is
         a '-2' and after it a '-x' then error out.
         But it's far too obfuscated. Use ':' to separate groups.
+
+uint64_t
+getopt64(char **argv, const char *applet_opts, ...)
+
+        Same as getopt32, but allows up to 64 options, for applets
+        which have run out of bits. option_mask32 still gets
+        the lower 32 bits of the result.
 */
 
 /* Code here assumes that 'unsigned' is at least 32 bits wide */
@@ -307,10 +314,10 @@ enum {
 typedef struct {
 	unsigned char opt_char;
 	smallint param_type;
-	unsigned switch_on;
-	unsigned switch_off;
-	unsigned incongruously;
-	unsigned requires;
+	uint64_t switch_on;
+	uint64_t switch_off;
+	uint64_t incongruously;
+	uint64_t requires;
 	void **optarg;  /* char**, llist_t** or int *. */
 	int *counter;
 } t_complementary;
@@ -325,23 +332,22 @@ const char *applet_long_options;
 
 uint32_t option_mask32;
 
-uint32_t FAST_FUNC
-getopt32(char **argv, const char *applet_opts, ...)
+static uint64_t
+vgetopt(char **argv, const char *applet_opts, int maxbits, va_list p)
 {
 	int argc;
-	unsigned flags = 0;
-	unsigned requires = 0;
-	t_complementary complementary[33]; /* last stays zero-filled */
+	uint64_t flags = 0;
+	uint64_t requires = 0;
+	t_complementary complementary[65]; /* last stays zero-filled */
 	char first_char;
 	int c;
 	const unsigned char *s;
 	t_complementary *on_off;
-	va_list p;
 #if ENABLE_LONG_OPTS || ENABLE_FEATURE_GETOPT_LONG
 	const struct option *l_o;
 	struct option *long_options = (struct option *) &bb_null_long_options;
 #endif
-	unsigned trigger;
+	uint64_t trigger;
 	char **pargv;
 	int min_arg = 0;
 	int max_arg = -1;
@@ -357,8 +363,6 @@ getopt32(char **argv, const char *applet_opts, ...)
 	while (argv[argc])
 		argc++;
 
-	va_start(p, applet_opts);
-
 	c = 0;
 	on_off = complementary;
 	memset(on_off, 0, sizeof(complementary));
@@ -373,10 +377,10 @@ getopt32(char **argv, const char *applet_opts, ...)
 	if (*s == '+' || *s == '-')
 		s++;
 	while (*s) {
-		if (c >= 32)
+		if (c >= maxbits)
 			break;
 		on_off->opt_char = *s;
-		on_off->switch_on = (1 << c);
+		on_off->switch_on = ((uint64_t)1 << c);
 		if (*++s == ':') {
 			on_off->optarg = va_arg(p, void **);
 			while (*++s == ':')
@@ -416,10 +420,10 @@ getopt32(char **argv, const char *applet_opts, ...)
 			for (on_off = complementary; on_off->opt_char; on_off++)
 				if (on_off->opt_char == l_o->val)
 					goto next_long;
-			if (c >= 32)
+			if (c >= maxbits)
 				break;
 			on_off->opt_char = l_o->val;
-			on_off->switch_on = (1 << c);
+			on_off->switch_on = ((uint64_t)1 << c);
 			if (l_o->has_arg != no_argument)
 				on_off->optarg = va_arg(p, void **);
 			c++;
@@ -433,7 +437,7 @@ getopt32(char **argv, const char *applet_opts, ...)
 #endif /* ENABLE_LONG_OPTS || ENABLE_FEATURE_GETOPT_LONG */
 	for (s = (const unsigned char *)opt_complementary; s && *s; s++) {
 		t_complementary *pair;
-		unsigned *pair_switch;
+		uint64_t *pair_switch;
 
 		if (*s == ':')
 			continue;
@@ -515,7 +519,6 @@ getopt32(char **argv, const char *applet_opts, ...)
 		s--;
 	}
 	opt_complementary = NULL;
-	va_end(p);
 
 	if (spec_flgs & (FIRST_ARGV_IS_OPT | ALL_ARGV_IS_OPTS)) {
 		pargv = argv + 1;
@@ -611,5 +614,29 @@ getopt32(char **argv, const char *applet_opts, ...)
  error:
 	if (first_char != '!')
 		bb_show_usage();
-	return (int32_t)-1;
+	return (uint64_t)-1;
+}
+
+uint32_t FAST_FUNC
+getopt32(char **argv, const char *applet_opts, ...)
+{
+	uint32_t opts;
+	va_list p;
+
+	va_start(p, applet_opts);
+	opts = vgetopt(argv, applet_opts, 32, p);
+	va_end(p);
+	return opts;
+}
+
+uint64_t FAST_FUNC
+getopt64(char **argv, const char *applet_opts, ...)
+{
+	uint64_t opts;
+	va_list p;
+
+	va_start(p, applet_opts);
+	opts = vgetopt(argv, applet_opts, 64, p);
+	va_end(p);
+	return opts;
 }
@@ -10,18 +10,89 @@
 
 #include "libbb.h"
 
-typedef struct ino_dev_hash_bucket_struct {
-	struct ino_dev_hash_bucket_struct *next;
+/* Open addressing with linear probing; table size is a power of 2
+ * and doubles when it gets 3/4 full. Names are not malloced one by one,
+ * they are packed into big chunks which are only freed all together.
+ */
+typedef struct ino_dev_entry {
 	ino_t ino;
 	dev_t dev;
-	char name[1];
-} ino_dev_hashtable_bucket_t;
+	char *name; /* NULL: empty slot */
+} ino_dev_entry_t;
+
+typedef struct name_chunk {
+	struct name_chunk *next;
+	char buf[1];
+} name_chunk_t;
+
+#define INITIAL_SIZE  256
+#define CHUNK_SIZE    (16 * 1024 - sizeof(name_chunk_t))
+
+static struct {
+	ino_dev_entry_t *table;
+	unsigned mask;  /* table size - 1 */
+	unsigned used;
+	name_chunk_t *chunks;
+	unsigned chunk_avail;
+	char *chunk_pos;
+} ih;
+
+static unsigned hash_ino_dev(ino_t ino, dev_t dev)
+{
+	/* Inode numbers are often sequential: spread them out */
+	unsigned long long v = (unsigned long long)ino ^ ((unsigned long long)dev << 23);
+	v *= 0x9e3779b97f4a7c15ULL;
+	return (unsigned)(v >> 32);
+}
+
+static ino_dev_entry_t *find_slot(ino_dev_entry_t *table, unsigned mask,
+		ino_t ino, dev_t dev)
+{
+	unsigned i = hash_ino_dev(ino, dev) & mask;
+
+	while (table[i].name) {
+		if (table[i].ino == ino && table[i].dev == dev)
+			break;
+		i = (i + 1) & mask;
+	}
+	return &table[i];
+}
 
-#define HASH_SIZE      311   /* Should be prime */
-#define hash_inode(i)  ((i) % HASH_SIZE)
+static void grow_table(void)
+{
+	ino_dev_entry_t *old = ih.table;
+	unsigned old_size = old ? ih.mask + 1 : 0;
+	unsigned new_mask = old ? ih.mask * 2 + 1 : INITIAL_SIZE - 1;
+	unsigned i;
+
+	ih.table = xzalloc((new_mask + 1) * sizeof(ih.table[0]));
+	ih.mask = new_mask;
+	for (i = 0; i < old_size; i++) {
+		if (old[i].name)
+			*find_slot(ih.table, new_mask, old[i].ino, old[i].dev) = old[i];
+	}
+	free(old);
+}
+
+static char *store_name(const char *name)
+{
+	unsigned len = strlen(name) + 1;
+	char *p;
 
-/* array of [HASH_SIZE] elements */
-static ino_dev_hashtable_bucket_t **ino_dev_hashtable;
+	if (len > ih.chunk_avail) {
+		unsigned size = len > CHUNK_SIZE ? len : CHUNK_SIZE;
+		name_chunk_t *c = xmalloc(sizeof(*c) + size);
+		c->next = ih.chunks;
+		ih.chunks = c;
+		ih.chunk_pos = c->buf;
+		ih.chunk_avail = size;
+	}
+	p = ih.chunk_pos;
+	memcpy(p, name, len);
+	ih.chunk_pos += len;
+	ih.chunk_avail -= len;
+	return p;
+}
 
 /*
  * Return name if statbuf->st_ino && statbuf->st_dev are recorded in
@@ -29,59 +100,42 @@ static ino_dev_hashtable_bucket_t **ino_dev_hashtable;
  */
 char* FAST_FUNC is_in_ino_dev_hashtable(const struct stat *statbuf)
 {
-	ino_dev_hashtable_bucket_t *bucket;
-
-	if (!ino_dev_hashtable)
+	if (!ih.table)
 		return NULL;
-
-	bucket = ino_dev_hashtable[hash_inode(statbuf->st_ino)];
-	while (bucket != NULL) {
-		if ((bucket->ino == statbuf->st_ino)
-		 && (bucket->dev == statbuf->st_dev)
-		) {
-			return bucket->name;
-		}
-		bucket = bucket->next;
-	}
-	return NULL;
+	return find_slot(ih.table, ih.mask, statbuf->st_ino, statbuf->st_dev)->name;
 }
 
 /* Add statbuf to statbuf hash table */
 void FAST_FUNC add_to_ino_dev_hashtable(const struct stat *statbuf, const char *name)
 {
-	int i;
-	ino_dev_hashtable_bucket_t *bucket;
+	ino_dev_entry_t *e;
 
-	i = hash_inode(statbuf->st_ino);
 	if (!name)
 		name = "";
-	bucket = xmalloc(sizeof(ino_dev_hashtable_bucket_t) + strlen(name));
-	bucket->ino = statbuf->st_ino;
-	bucket->dev = statbuf->st_dev;
-	strcpy(bucket->name, name);
-
-	if (!ino_dev_hashtable)
-		ino_dev_hashtable = xzalloc(HASH_SIZE * sizeof(*ino_dev_hashtable));
+	/* Keep load factor under 3/4 */
+	if (!ih.table || ih.used >= (ih.mask + 1) / 4 * 3)
+		grow_table();
 
-	bucket->next = ino_dev_hashtable[i];
-	ino_dev_hashtable[i] = bucket;
+	e = find_slot(ih.table, ih.mask, statbuf->st_ino, statbuf->st_dev);
+	if (!e->name)
+		ih.used++;
+	/* else: same inode added again, the newest name wins
+	 * (old code returned the most recently added one too) */
+	e->ino = statbuf->st_ino;
+	e->dev = statbuf->st_dev;
+	e->name = store_name(name);
 }
 
 #if ENABLE_DU || ENABLE_FEATURE_CLEAN_UP
 /* Clear statbuf hash table */
 void FAST_FUNC reset_ino_dev_hashtable(void)
 {
-	int i;
-	ino_dev_hashtable_bucket_t *bucket;
-
-	for (i = 0; ino_dev_hashtable && i < HASH_SIZE; i++) {
-		while (ino_dev_hashtable[i] != NULL) {
-			bucket = ino_dev_hashtable[i]->next;
-			free(ino_dev_hashtable[i]);
-			ino_dev_hashtable[i] = bucket;
-		}
+	while (ih.chunks) {
+		name_chunk_t *c = ih.chunks;
+		ih.chunks = c->next;
+		free(c);
 	}
-	free(ino_dev_hashtable);
-	ino_dev_hashtable = NULL;
+	free(ih.table);
+	memset(&ih, 0, sizeof(ih));
 }
 #endif
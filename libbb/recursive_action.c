@@ -51,9 +51,21 @@ static int FAST_FUNC true_action(const char *fileName UNUSED_PARAM,
  * ACTION_FOLLOWLINKS mainly controls handling of links to dirs.
  * 0: lstat(statbuf). Calls fileAction on link name even if points to dir.
  * 1: stat(statbuf). Calls dirAction and optionally recurse on link to dir.
+ *
+ * ACTION_NO_STAT: below depth 0, if readdir reports file type,
+ * statbuf is all zeros except for S_IFMT bits of st_mode.
+ *
+ * Entries are stat'ed and opened relative to their directory's fd,
+ * so the kernel does not look up the whole path again for each of them.
  */
 
-int FAST_FUNC recursive_action(const char *fileName,
+#ifndef DTTOIF
+# define DTTOIF(dirtype) ((dirtype) << 12)
+#endif
+
+static int recursive_action1(int dir_fd, const char *name,
+		const char *fileName,
+		unsigned d_type,
 		unsigned flags,
 		int FAST_FUNC (*fileAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
 		int FAST_FUNC (*dirAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
@@ -66,27 +78,33 @@ int FAST_FUNC recursive_action(const char *fileName,
 	DIR *dir;
 	struct dirent *next;
 
-	if (!fileAction) fileAction = true_action;
-	if (!dirAction) dirAction = true_action;
-
 	follow = ACTION_FOLLOWLINKS;
 	if (depth == 0)
 		follow = ACTION_FOLLOWLINKS | ACTION_FOLLOWLINKS_L0;
 	follow &= flags;
-	status = (follow ? stat : lstat)(fileName, &statbuf);
+	if ((flags & ACTION_NO_STAT)
+	 && d_type != DT_UNKNOWN
+	 && !(follow && d_type == DT_LNK)
+	) {
+		memset(&statbuf, 0, sizeof(statbuf));
+		statbuf.st_mode = DTTOIF(d_type);
+		goto got_stat;
+	}
+	status = fstatat(dir_fd, name, &statbuf, follow ? 0 : AT_SYMLINK_NOFOLLOW);
 	if (status < 0) {
 #ifdef DEBUG_RECURS_ACTION
 		bb_error_msg("status=%d flags=%x", status, flags);
 #endif
 		if ((flags & ACTION_DANGLING_OK)
 		 && errno == ENOENT
-		 && lstat(fileName, &statbuf) == 0
+		 && fstatat(dir_fd, name, &statbuf, AT_SYMLINK_NOFOLLOW) == 0
 		) {
 			/* Dangling link */
 			return fileAction(fileName, &statbuf, userData, depth);
 		}
 		goto done_nak_warn;
 	}
+ got_stat:
 
 	/* If S_ISLNK(m), then we know that !S_ISDIR(m).
 	 * Then we can skip checking first part: if it is true, then
@@ -111,7 +129,13 @@ int FAST_FUNC recursive_action(const char *fileName,
 			return TRUE;
 	}
 
-	dir = opendir(fileName);
+	dir = NULL;
+	status = openat(dir_fd, name, O_RDONLY | O_DIRECTORY);
+	if (status >= 0) {
+		dir = fdopendir(status);
+		if (!dir)
+			close(status);
+	}
 	if (!dir) {
 		/* findutils-4.1.20 reports this */
 		/* (i.e. it doesn't silently return with exit code 1) */
@@ -126,7 +150,9 @@ int FAST_FUNC recursive_action(const char *fileName,
 		if (nextFile == NULL)
 			continue;
 		/* process every file (NB: ACTION_RECURSE is set in flags) */
-		if (!recursive_action(nextFile, flags, fileAction, dirAction,
+		if (!recursive_action1(dirfd(dir), next->d_name, nextFile,
+						next->d_type, flags,
+						fileAction, dirAction,
 						userData, depth + 1))
 			status = FALSE;
 //		s = recursive_action(nextFile, flags, fileAction, dirAction,
@@ -154,3 +180,17 @@ int FAST_FUNC recursive_action(const char *fileName,
 		bb_simple_perror_msg(fileName);
 	return FALSE;
 }
+
+int FAST_FUNC recursive_action(const char *fileName,
+		unsigned flags,
+		int FAST_FUNC (*fileAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		int FAST_FUNC (*dirAction)(const char *fileName, struct stat *statbuf, void* userData, int depth),
+		void* userData,
+		unsigned depth)
+{
+	if (!fileAction) fileAction = true_action;
+	if (!dirAction) dirAction = true_action;
+
+	return recursive_action1(AT_FDCWD, fileName, fileName, DT_UNKNOWN,
+			flags, fileAction, dirAction, userData, depth);
+}
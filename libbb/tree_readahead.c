@@ -0,0 +1,205 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * Utility routines.
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this source tree.
+ */
+
+/* Background "readahead" of directory trees.
+ *
+ * A few threads walk the trees which an applet is about to walk itself,
+ * doing nothing but readdir and fstatat. They share one stack of
+ * directories still to be read: whichever thread is free takes the next
+ * one and pushes the subdirectories it finds, so a single big subtree
+ * is spread across all of them.
+ *
+ * The applet's own walk is unchanged - same order, same callbacks,
+ * same output - but on network filesystems most of its stats find
+ * the attributes already cached by the kernel.
+ *
+ * Threads never call xfuncs and never touch applet state,
+ * so it is safe for them to run under any single-threaded applet code.
+ * On any error they just skip the directory.
+ */
+#include "libbb.h"
+#include <pthread.h>
+
+#define NUM_THREADS CONFIG_FEATURE_TREE_READAHEAD_THREADS
+
+struct ra_dir {
+	struct ra_dir *next;
+	char path[1];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct ra_dir *stack;
+	unsigned busy;      /* threads reading a directory now */
+	unsigned nthreads;
+	volatile smallint stop;
+	pthread_t tid[NUM_THREADS];
+} ra = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+};
+
+static struct ra_dir *new_ra_dir(const char *dir, const char *name)
+{
+	size_t dlen = dir ? strlen(dir) : 0;
+	size_t nlen = strlen(name);
+	/* sizeof includes path[1], room for "/" is taken below */
+	struct ra_dir *d = malloc(sizeof(*d) + dlen + nlen + 1);
+
+	if (d) {
+		char *p = d->path;
+		if (dir) {
+			p = mempcpy(p, dir, dlen);
+			if (dlen == 0 || p[-1] != '/')
+				*p++ = '/';
+		}
+		strcpy(p, name);
+	}
+	return d;
+}
+
+/* Called with ra.lock held */
+static void push_list(struct ra_dir *head, struct ra_dir *tail)
+{
+	tail->next = ra.stack;
+	ra.stack = head;
+	pthread_cond_broadcast(&ra.cond);
+}
+
+static void read_one_dir(const char *path)
+{
+	struct dirent *de;
+	struct ra_dir *head, *tail;
+	DIR *dir;
+	int fd;
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+	fd = dirfd(dir);
+	head = tail = NULL;
+	while (!ra.stop && (de = readdir(dir)) != NULL) {
+		struct stat st;
+		struct ra_dir *d;
+
+		if (DOT_OR_DOTDOT(de->d_name))
+			continue;
+		/* This is the point: bring inode into cache */
+		if (fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+			continue;
+		if (!S_ISDIR(st.st_mode))
+			continue;
+		d = new_ra_dir(path, de->d_name);
+		if (!d)
+			continue;
+		/* Keep readdir order: the first subdirectory
+		 * will be on top of the stack, as the applet visits it first */
+		d->next = NULL;
+		if (tail)
+			tail->next = d;
+		else
+			head = d;
+		tail = d;
+	}
+	closedir(dir);
+
+	if (head) {
+		pthread_mutex_lock(&ra.lock);
+		push_list(head, tail);
+		pthread_mutex_unlock(&ra.lock);
+	}
+}
+
+static void *ra_thread(void *arg UNUSED_PARAM)
+{
+	pthread_mutex_lock(&ra.lock);
+	for (;;) {
+		struct ra_dir *d = ra.stack;
+		if (d) {
+			ra.stack = d->next;
+			ra.busy++;
+			pthread_mutex_unlock(&ra.lock);
+			read_one_dir(d->path);
+			free(d);
+			pthread_mutex_lock(&ra.lock);
+			ra.busy--;
+			continue;
+		}
+		/* Stack is empty. If nobody is reading a directory,
+		 * nobody can refill it: the walk is complete */
+		if (ra.stop || ra.busy == 0)
+			break;
+		pthread_cond_wait(&ra.cond, &ra.lock);
+	}
+	/* Wake up the rest so that they see it too */
+	pthread_cond_broadcast(&ra.cond);
+	pthread_mutex_unlock(&ra.lock);
+	return NULL;
+}
+
+void FAST_FUNC tree_readahead_start(char **paths)
+{
+	pthread_attr_t attr;
+	sigset_t all, old;
+	struct ra_dir *head, *tail;
+
+	if (ra.nthreads) /* already running */
+		return;
+
+	head = tail = NULL;
+	while (*paths) {
+		struct ra_dir *d = new_ra_dir(NULL, *paths++);
+		if (!d)
+			break;
+		d->next = NULL;
+		if (tail)
+			tail->next = d;
+		else
+			head = d;
+		tail = d;
+	}
+	if (!head)
+		return;
+	ra.stop = 0;
+	ra.busy = 0;
+	push_list(head, tail);
+
+	/* Signals are for the applet, not for us */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, 64 * 1024);
+	while (ra.nthreads < NUM_THREADS) {
+		if (pthread_create(&ra.tid[ra.nthreads], &attr, ra_thread, NULL) != 0)
+			break;
+		ra.nthreads++;
+	}
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void FAST_FUNC tree_readahead_stop(void)
+{
+	unsigned i;
+
+	/* Threads notice it between readdir's */
+	pthread_mutex_lock(&ra.lock);
+	ra.stop = 1;
+	pthread_cond_broadcast(&ra.cond);
+	pthread_mutex_unlock(&ra.lock);
+
+	for (i = 0; i < ra.nthreads; i++)
+		pthread_join(ra.tid[i], NULL);
+	ra.nthreads = 0;
+
+	while (ra.stack) {
+		struct ra_dir *d = ra.stack;
+		ra.stack = d->next;
+		free(d);
+	}
+}
@@ -69,12 +69,16 @@ pid_t FAST_FUNC xspawn(char **argv)
 }
 
 #if ENABLE_FEATURE_PREFER_APPLETS
+/* Nonzero while a NOFORK applet runs inside its caller's process */
+smallint running_nofork;
+
 struct nofork_save_area {
 	jmp_buf die_jmp;
 	const char *applet_name;
 	uint32_t option_mask32;
 	int die_sleep;
 	uint8_t xfunc_error_retval;
+	smallint running_nofork;
 };
 static void save_nofork_data(struct nofork_save_area *save)
 {
@@ -83,6 +87,7 @@ static void save_nofork_data(struct nofork_save_area *save)
 	save->xfunc_error_retval = xfunc_error_retval;
 	save->option_mask32 = option_mask32;
 	save->die_sleep = die_sleep;
+	save->running_nofork = running_nofork;
 }
 static void restore_nofork_data(struct nofork_save_area *save)
 {
@@ -91,6 +96,7 @@ static void restore_nofork_data(struct nofork_save_area *save)
 	xfunc_error_retval = save->xfunc_error_retval;
 	option_mask32 = save->option_mask32;
 	die_sleep = save->die_sleep;
+	running_nofork = save->running_nofork;
 }
 
 int FAST_FUNC run_nofork_applet(int applet_no, char **argv)
@@ -137,6 +143,7 @@ int FAST_FUNC run_nofork_applet(int applet_no, char **argv)
 	 * in NOFORK applet, xfunc_die() sees negative
 	 * die_sleep and longjmp here instead. */
 	die_sleep = -1;
+	running_nofork = 1;
 
 	rc = setjmp(die_jmp);
 	if (!rc) {
@@ -152,6 +159,12 @@ int FAST_FUNC run_nofork_applet(int applet_no, char **argv)
 			rc = 0;
 	}
 
+	/* Output must reach the fd it was meant for before the caller
+	 * undoes redirections. A write error (EPIPE, ENOSPC) should not
+	 * make the next applet's die_if_ferror_stdout() fail too. */
+	fflush_all();
+	clearerr(stdout);
+
 	/* Restoring some globals */
 	restore_nofork_data(&old);
 
@@ -22,6 +22,21 @@ FILE* FAST_FUNC fopen_or_warn_stdin(const char *filename)
 	 && NOT_LONE_DASH(filename)
 	) {
 		fp = fopen_or_warn(filename, "r");
+	} else if (running_nofork) {
+		/* Reading through the caller's stdin FILE would leave
+		 * read-ahead in its buffer, and anything already buffered
+		 * there predates any redirection of fd 0. Use a private FILE
+		 * on a copy of fd 0, just as a forked child would have.
+		 * fclose_if_not_stdin() closes it. */
+		int fd = dup(STDIN_FILENO);
+		fp = NULL;
+		if (fd >= 0) {
+			fp = fdopen(fd, "r");
+			if (!fp)
+				close(fd);
+		}
+		if (!fp)
+			bb_simple_perror_msg(bb_msg_standard_input);
 	}
 	return fp;
 }
@@ -132,6 +132,17 @@ enum {
 	MAXLINES = CONFIG_FEATURE_LESS_MAXLINES,
 /* This many "after the end" lines we will show (at max) */
 	TILDES = 1,
+/* Regular files this big are not kept in memory, see fline() */
+	SPARSE_SIZE = 8 * 1024 * 1024,
+	FLINE_BLOCK = 128,
+	FLINE_SLOTS = 8, /* unless more than that are on screen */
+/* Sparse mode needs only an anchor per FLINE_BLOCK flines, so MAXLINES
+ * does not apply. A line's number is never above its fline's index,
+ * so this keeps both int cur_fline (with room for cur_fline + screen
+ * height) and uint32_t LINENO() from wrapping */
+	SPARSE_MAXLINES = INT_MAX / 2,
+/* Search this many lines at once, then check for keypresses */
+	SEARCH_CHUNK = 4096,
 };
 
 /* Command line options */
@@ -151,6 +162,23 @@ enum {
 enum { pattern_valid = 0 };
 #endif
 
+/* Where flines[n * FLINE_BLOCK] starts in the file */
+struct fline_anchor {
+	off_t off;
+	uint32_t lineno;
+	smallint cont; /* it is a linewrap continuation */
+};
+
+/* FLINE_BLOCK flines re-read from the file */
+struct fline_block {
+	unsigned blk;
+	unsigned cnt;
+	unsigned tick;
+	smallint pinned; /* buffer[] points into it */
+	char *mem;
+	const char *line[FLINE_BLOCK];
+};
+
 struct globals {
 	int cur_fline; /* signed */
 	int kbd_fd;  /* fd to get input from */
@@ -180,6 +208,10 @@ struct globals {
 #endif
 #if ENABLE_FEATURE_LESS_REGEXP
 	unsigned *match_lines;
+	unsigned match_start; /* searching starts at this fline */
+	unsigned match_scan; /* flines[match_start..match_scan-1] are searched */
+	unsigned back_scan; /* flines[0..back_scan-1] are searched */
+	int num_back; /* match_lines[] entries before match_start */
 	int match_pos; /* signed! */
 	int wanted_match; /* signed! */
 	int num_matches;
@@ -190,6 +222,17 @@ struct globals {
 	smallint winsize_err;
 #endif
 	smallint terminated;
+	smallint sparse;
+	off_t file_off; /* file offset of readbuf[0] */
+	off_t line_off; /* file offset of flines[max_fline] */
+	smallint line_cont;
+	unsigned fl_tick;
+	unsigned fill_tick;
+	unsigned num_slots;
+	unsigned num_anchors;
+	struct fline_anchor *anchors;
+	struct fline_block *fblocks;
+	const char *last_fline;
 	struct termios term_orig, term_less;
 	char kbd_input[KEYCODE_BUFFER_SIZE];
 };
@@ -219,6 +262,10 @@ struct globals {
 #define mark_lines          (G.mark_lines        )
 #if ENABLE_FEATURE_LESS_REGEXP
 #define match_lines         (G.match_lines       )
+#define match_start         (G.match_start       )
+#define match_scan          (G.match_scan        )
+#define back_scan           (G.back_scan         )
+#define num_back            (G.num_back          )
 #define match_pos           (G.match_pos         )
 #define num_matches         (G.num_matches       )
 #define wanted_match        (G.wanted_match      )
@@ -229,6 +276,7 @@ struct globals {
 #define term_orig           (G.term_orig         )
 #define term_less           (G.term_less         )
 #define kbd_input           (G.kbd_input         )
+#define MAX_FLINES          (G.sparse ? SPARSE_MAXLINES : MAXLINES)
 #define INIT_G() do { \
 	SET_PTR_TO_GLOBALS(xzalloc(sizeof(G))); \
 	less_gets_pos = -1; \
@@ -247,6 +295,150 @@ struct globals {
 #define MEMPTR(p) ((char*)(p) - 4)
 #define LINENO(p) (*(uint32_t*)((p) - 4))
 
+/* Large regular files are not kept in memory ("sparse" mode).
+ * read_lines() remembers only where every FLINE_BLOCK'th fline starts
+ * and the last fline; others are re-read and re-wrapped on demand
+ * into a few block buffers. Pointers returned by fline() stay valid
+ * until FLINE_SLOTS other blocks are touched, or, for lines
+ * which are on screen, until the next buffer_fill_and_print().
+ */
+static void load_fline_block(struct fline_block *fb, unsigned blk)
+{
+	const struct fline_anchor *a = &G.anchors[blk];
+	off_t end = (blk + 1 < G.num_anchors) ? a[1].off : G.line_off;
+	unsigned want = max_fline - blk * FLINE_BLOCK;
+	int w = width;
+	uint32_t lineno = a->lineno;
+	smallint last_terminated = !a->cont;
+	ssize_t len;
+	char *raw, *s, *e, *p;
+
+	if (option_mask32 & FLAG_N)
+		w -= 8;
+	if (want > FLINE_BLOCK)
+		want = FLINE_BLOCK;
+	len = end - a->off;
+	raw = xmalloc(len);
+	len = pread(STDIN_FILENO, raw, len, a->off);
+	if (len < 0)
+		len = 0;
+	free(fb->mem);
+	/* Each line takes at most its chars + NUL + 3 pad + 4 lineno bytes */
+	fb->mem = p = xmalloc(len + (want + 1) * 8);
+	fb->blk = blk;
+	fb->cnt = 0;
+
+	/* Same as the line splitting in read_lines() */
+	s = raw;
+	e = raw + len;
+	while (fb->cnt < want) {
+		char *line = p + 4;
+		char *d = line;
+		size_t pos = 0;
+		smallint term = 0;
+
+		while (s < e) {
+			char c = *s;
+			size_t new_pos;
+			if (c == '\x8' && pos && d[-1] != '\t') {
+				s++;
+				pos--;
+				d--;
+				continue;
+			}
+			new_pos = pos + 1;
+			if (c == '\t') {
+				new_pos += 7;
+				new_pos &= (~7);
+			}
+			if ((int)new_pos >= w)
+				break;
+			pos = new_pos;
+			s++;
+			if (c == '\n') {
+				term = 1;
+				break;
+			}
+			if (c == '\0') c = '\n';
+			*d++ = c;
+		}
+		if (d == line) {
+			if (!term)
+				break; /* short read */
+			if (!last_terminated) {
+				/* linewrap with only "" wrapping to next line */
+				last_terminated = 1;
+				lineno++;
+				continue;
+			}
+		}
+		*d = '\0';
+		LINENO(line) = lineno;
+		fb->line[fb->cnt++] = line;
+		p = line + ((d - line + 4) & ~3);
+		if (term)
+			lineno++;
+		last_terminated = term;
+	}
+	free(raw);
+	/* File shrank under us? Pad with empty lines */
+	if (fb->cnt < want) {
+		LINENO(p + 4) = lineno;
+		p[4] = '\0';
+		while (fb->cnt < want)
+			fb->line[fb->cnt++] = p + 4;
+	}
+}
+
+static const char *fline(unsigned i)
+{
+	struct fline_block *fb, *lru;
+	unsigned blk, n;
+
+	if (!G.sparse)
+		return flines[i];
+	if (i == max_fline)
+		return G.last_fline;
+	blk = i / FLINE_BLOCK;
+	n = i % FLINE_BLOCK;
+	lru = NULL;
+	for (fb = G.fblocks; fb < G.fblocks + G.num_slots; fb++) {
+		/* (cnt may be short if block was read before it was complete) */
+		if (fb->mem && fb->blk == blk && n < fb->cnt)
+			goto found;
+		if (fb->pinned || (G.fill_tick && fb->tick >= G.fill_tick))
+			continue;
+		if (!lru || fb->tick < lru->tick)
+			lru = fb;
+	}
+	if (!lru || G.num_slots < FLINE_SLOTS) {
+		G.fblocks = xrealloc_vector(G.fblocks, 3, G.num_slots);
+		lru = &G.fblocks[G.num_slots++];
+	}
+	fb = lru;
+	load_fline_block(fb, blk);
+ found:
+	fb->tick = ++G.fl_tick;
+	return fb->line[n];
+}
+
+static void free_sparse(void)
+{
+	unsigned i;
+
+	for (i = 0; i < G.num_slots; i++)
+		free(G.fblocks[i].mem);
+	free(G.fblocks);
+	G.fblocks = NULL;
+	G.num_slots = 0;
+	free(G.anchors);
+	G.anchors = NULL;
+	G.num_anchors = 0;
+	if (G.last_fline)
+		free(MEMPTR(G.last_fline));
+	G.last_fline = NULL;
+}
+
 
 /* Reset terminal input to normal */
 static void set_tty_cooked(void)
@@ -290,6 +482,38 @@ static void less_exit(int code)
 
 #if (ENABLE_FEATURE_LESS_DASHCMD && ENABLE_FEATURE_LESS_LINENUMS) \
  || ENABLE_FEATURE_LESS_WINCH
+static void read_lines(void);
+
+/* Sparse mode can't re-wrap what it does not have:
+ * index the file again, up to the line we were looking at */
+static void re_index(void)
+{
+	uint32_t lineno = LINENO(fline(cur_fline));
+	off_t start = G.anchors[0].off;
+
+	free_sparse();
+	xlseek(STDIN_FILENO, start, SEEK_SET);
+	G.file_off = start;
+	readpos = 0;
+	readeof = 0;
+	last_line_pos = 0;
+	terminated = 1;
+	eof_error = 1;
+	max_fline = -1;
+	max_lineno = 0;
+#if ENABLE_FEATURE_LESS_REGEXP
+	pattern_valid = 0;
+#endif
+	do {
+		cur_fline = max_fline + 1024;
+		read_lines();
+	} while (max_lineno <= lineno && eof_error > 0);
+
+	cur_fline = max_fline;
+	while (cur_fline > 0 && LINENO(fline(cur_fline - 1)) >= lineno)
+		cur_fline--;
+}
+
 static void re_wrap(void)
 {
 	int w = width;
@@ -304,6 +528,11 @@ static void re_wrap(void)
 	char **new_flines = NULL;
 	char *d;
 
+	if (G.sparse) {
+		re_index();
+		return;
+	}
+
 	if (option_mask32 & FLAG_N)
 		w -= 8;
 
@@ -375,9 +604,14 @@ static void re_wrap(void)
 #endif
 
 #if ENABLE_FEATURE_LESS_REGEXP
-static void fill_match_lines(unsigned pos);
+static void fill_match_lines(unsigned count);
+static void fill_back_match_lines(unsigned count);
+#define search_pending() (pattern_valid \
+	&& (match_scan <= max_fline || back_scan < match_start))
 #else
-#define fill_match_lines(pos) ((void)0)
+#define fill_match_lines(count) ((void)0)
+#define fill_back_match_lines(count) ((void)0)
+#define search_pending() 0
 #endif
 
 /* Devilishly complex routine.
@@ -410,7 +644,6 @@ static void read_lines(void)
 	int w = width;
 	char last_terminated = terminated;
 #if ENABLE_FEATURE_LESS_REGEXP
-	unsigned old_max_fline = max_fline;
 	time_t last_time = 0;
 	unsigned seconds_p1 = 3; /* seconds_to_loop + 1 */
 #endif
@@ -423,13 +656,21 @@ static void read_lines(void)
 	p = current_line = ((char*)xmalloc(w + 4)) + 4;
 	max_fline += last_terminated;
 	if (!last_terminated) {
-		const char *cp = flines[max_fline];
+		const char *cp = fline(max_fline);
 		strcpy(p, cp);
 		p += strlen(current_line);
-		free(MEMPTR(flines[max_fline]));
+		free(MEMPTR(cp));
+		G.last_fline = NULL;
+#if ENABLE_FEATURE_LESS_REGEXP
+		/* It will grow, search it again */
+		if (match_scan > max_fline && match_start <= max_fline)
+			match_scan = max_fline;
+#endif
 		/* last_line_pos is still valid from previous read_lines() */
 	} else {
 		last_line_pos = 0;
+		G.line_off = G.file_off + readpos;
+		G.line_cont = 0;
 	}
 
 	while (1) { /* read lines until we reach cur_fline or wanted_match */
@@ -439,6 +680,8 @@ static void read_lines(void)
 			char c;
 			/* if no unprocessed chars left, eat more */
 			if (readpos >= readeof) {
+				if (readeof > 0)
+					G.file_off += readeof;
 				ndelay_on(0);
 				eof_error = safe_read(STDIN_FILENO, readbuf, sizeof(readbuf));
 				ndelay_off(0);
@@ -485,33 +728,46 @@ static void read_lines(void)
 		if (!last_terminated && !current_line[0]) {
 			last_terminated = 1;
 			max_lineno++;
+			G.line_off = G.file_off + readpos;
+			G.line_cont = 0;
 			continue;
 		}
  reached_eof:
 		last_terminated = terminated;
-		flines = xrealloc_vector(flines, 8, max_fline);
-
-		flines[max_fline] = (char*)xrealloc(MEMPTR(current_line), strlen(current_line) + 1 + 4) + 4;
-		LINENO(flines[max_fline]) = max_lineno;
+		current_line = (char*)xrealloc(MEMPTR(current_line), strlen(current_line) + 1 + 4) + 4;
+		LINENO(current_line) = max_lineno;
+		if (G.sparse) {
+			if (max_fline == G.num_anchors * FLINE_BLOCK) {
+				G.anchors = xrealloc_vector(G.anchors, 6, G.num_anchors);
+				G.anchors[G.num_anchors].off = G.line_off;
+				G.anchors[G.num_anchors].lineno = max_lineno;
+				G.anchors[G.num_anchors].cont = G.line_cont;
+				G.num_anchors++;
+			}
+			if (G.last_fline)
+				free(MEMPTR(G.last_fline));
+			G.last_fline = current_line;
+		} else {
+			flines = xrealloc_vector(flines, 8, max_fline);
+			flines[max_fline] = current_line;
+		}
 		if (terminated)
 			max_lineno++;
 
-		if (max_fline >= MAXLINES) {
+		if (max_fline >= MAX_FLINES) {
 			eof_error = 0; /* Pretend we saw EOF */
 			break;
 		}
 		if (!(option_mask32 & FLAG_S)
 		  ? (max_fline > cur_fline + max_displayed_line)
 		  : (max_fline >= cur_fline
-		     && max_lineno > LINENO(flines[cur_fline]) + max_displayed_line)
+		     && max_lineno > LINENO(fline(cur_fline)) + max_displayed_line)
 		) {
 #if !ENABLE_FEATURE_LESS_REGEXP
 			break;
 #else
-			if (wanted_match >= num_matches) { /* goto_match called us */
-				fill_match_lines(old_max_fline);
-				old_max_fline = max_fline;
-			}
+			if (wanted_match >= num_matches) /* goto_match called us */
+				fill_match_lines(UINT_MAX);
 			if (wanted_match < num_matches)
 				break;
 #endif
@@ -548,8 +804,11 @@ static void read_lines(void)
 		current_line = ((char*)xmalloc(w + 4)) + 4;
 		p = current_line;
 		last_line_pos = 0;
+		G.line_off = G.file_off + readpos;
+		G.line_cont = !terminated;
 	} /* end of "read lines until we reach cur_fline" loop */
-	fill_match_lines(old_max_fline);
+	/* The rest is searched while waiting for keypresses */
+	fill_match_lines(SEARCH_CHUNK);
 #if ENABLE_FEATURE_LESS_REGEXP
 	/* prevent us from being stuck in search for a match */
 	wanted_match = -1;
@@ -803,33 +1062,40 @@ static void buffer_fill_and_print(void)
 	unsigned i;
 #if ENABLE_FEATURE_LESS_DASHCMD
 	int fpos = cur_fline;
+#endif
+
+	G.fill_tick = G.fl_tick + 1;
+#if ENABLE_FEATURE_LESS_DASHCMD
 
 	if (option_mask32 & FLAG_S) {
 		/* Go back to the beginning of this line */
-		while (fpos && LINENO(flines[fpos]) == LINENO(flines[fpos-1]))
+		while (fpos && LINENO(fline(fpos)) == LINENO(fline(fpos-1)))
 			fpos--;
 	}
 
 	i = 0;
 	while (i <= max_displayed_line && fpos <= max_fline) {
-		int lineno = LINENO(flines[fpos]);
-		buffer[i] = flines[fpos];
+		int lineno = LINENO(fline(fpos));
+		buffer[i] = fline(fpos);
 		i++;
 		do {
 			fpos++;
 		} while ((fpos <= max_fline)
 		      && (option_mask32 & FLAG_S)
-		      && lineno == LINENO(flines[fpos])
+		      && lineno == LINENO(fline(fpos))
 		);
 	}
 #else
 	for (i = 0; i <= max_displayed_line && cur_fline + i <= max_fline; i++) {
-		buffer[i] = flines[cur_fline + i];
+		buffer[i] = fline(cur_fline + i);
 	}
 #endif
 	for (; i <= max_displayed_line; i++) {
 		buffer[i] = empty_line_marker;
 	}
+	for (i = 0; i < G.num_slots; i++)
+		G.fblocks[i].pinned = (G.fblocks[i].tick >= G.fill_tick);
+	G.fill_tick = 0;
 	buffer_print();
 }
 
@@ -866,6 +1132,8 @@ static void buffer_line(int linenum)
 
 static void open_file_and_read_lines(void)
 {
+	struct stat st;
+
 	if (filename) {
 		xmove_fd(xopen(filename, O_RDONLY), STDIN_FILENO);
 	} else {
@@ -873,6 +1141,10 @@ static void open_file_and_read_lines(void)
 		/* For status line only */
 		filename = xstrdup(bb_msg_standard_input);
 	}
+	G.sparse = (fstat(STDIN_FILENO, &st) == 0
+		&& S_ISREG(st.st_mode) && st.st_size >= SPARSE_SIZE
+	);
+	G.file_off = G.sparse ? lseek(STDIN_FILENO, 0, SEEK_CUR) : 0;
 	readpos = 0;
 	readeof = 0;
 	last_line_pos = 0;
@@ -891,6 +1163,17 @@ static void reinitialize(void)
 		free(flines);
 		flines = NULL;
 	}
+	free_sparse();
+#if ENABLE_FEATURE_LESS_REGEXP
+	/* Search for the same pattern in the new file */
+	free(match_lines);
+	match_lines = NULL;
+	num_matches = 0;
+	match_pos = 0;
+	match_start = match_scan = 0;
+	back_scan = 0;
+	num_back = 0;
+#endif
 
 	max_fline = -1;
 	cur_fline = 0;
@@ -927,7 +1210,7 @@ static int64_t getch_nowait(void)
 	if (!(option_mask32 & FLAG_S)
 	   ? !(max_fline > cur_fline + max_displayed_line)
 	   : !(max_fline >= cur_fline
-	       && max_lineno > LINENO(flines[cur_fline]) + max_displayed_line)
+	       && max_lineno > LINENO(fline(cur_fline)) + max_displayed_line)
 	) {
 		if (eof_error > 0) /* did NOT reach eof yet */
 			rd = 0; /* yes, we are interested in stdin */
@@ -942,13 +1225,19 @@ static int64_t getch_nowait(void)
 		while (1) {
 			int r;
 			/* NB: SIGWINCH interrupts poll() */
-			r = poll(pfd + rd, 2 - rd, -1);
+			r = poll(pfd + rd, 2 - rd, search_pending() ? 0 : -1);
 			if (/*r < 0 && errno == EINTR &&*/ winch_counter)
 				return '\\'; /* anything which has no defined function */
 			if (r) break;
+			/* Nothing to do, continue searching */
+			fill_match_lines(SEARCH_CHUNK);
+			fill_back_match_lines(SEARCH_CHUNK);
 		}
 #else
-		safe_poll(pfd + rd, 2 - rd, -1);
+		while (safe_poll(pfd + rd, 2 - rd, search_pending() ? 0 : -1) == 0) {
+			fill_match_lines(SEARCH_CHUNK);
+			fill_back_match_lines(SEARCH_CHUNK);
+		}
 #endif
 	}
 
@@ -1133,17 +1422,36 @@ static void normalize_match_pos(int match)
 	match_pos = match;
 }
 
+/* Search all lines before match_start. Returns match (relative
+ * to match_pos) adjusted for the matches inserted before it */
+static int fill_all_back_match_lines(int match)
+{
+	match -= match_pos;
+	fill_back_match_lines(UINT_MAX);
+	return match + match_pos;
+}
+
 static void goto_match(int match)
 {
 	if (!pattern_valid)
 		return;
+	/* Lines before the search start are searched in background.
+	 * Going back past what was found there needs all of them */
+	if (match < num_back && back_scan < match_start)
+		match = fill_all_back_match_lines(match);
 	if (match < 0)
 		match = 0;
+	/* Search lines we already have, but only as far as needed */
+	while (match >= num_matches && match_scan <= max_fline)
+		fill_match_lines(SEARCH_CHUNK);
 	/* Try to find next match if eof isn't reached yet */
 	if (match >= num_matches && eof_error > 0) {
 		wanted_match = match; /* "I want to read until I see N'th match" */
 		read_lines();
 	}
+	/* Nothing after the search start, look before it */
+	if (num_matches == num_back && back_scan < match_start)
+		match = fill_all_back_match_lines(match);
 	if (num_matches) {
 		normalize_match_pos(match);
 		buffer_line(match_lines[match_pos]);
@@ -1152,21 +1460,47 @@ static void goto_match(int match)
 	}
 }
 
-static void fill_match_lines(unsigned pos)
+/* Run the regex on (at most count) lines from match_start on
+ * not searched yet */
+static void fill_match_lines(unsigned count)
 {
 	if (!pattern_valid)
 		return;
-	/* Run the regex on each line of the current file */
-	while (pos <= max_fline) {
+	while (match_scan <= max_fline && count) {
+		unsigned pos = match_scan;
 		/* If this line matches */
-		if (regexec(&pattern, flines[pos], 0, NULL, 0) == 0
+		if (regexec(&pattern, fline(pos), 0, NULL, 0) == 0
 		/* and we didn't match it last time */
 		 && !(num_matches && match_lines[num_matches-1] == pos)
 		) {
 			match_lines = xrealloc_vector(match_lines, 4, num_matches);
 			match_lines[num_matches++] = pos;
 		}
-		pos++;
+		match_scan++;
+		count--;
+	}
+}
+
+/* Same for lines before match_start. Their matches are inserted
+ * before the ones found after it, match_pos keeps pointing to the same line */
+static void fill_back_match_lines(unsigned count)
+{
+	if (!pattern_valid)
+		return;
+	while (back_scan < match_start && count) {
+		unsigned pos = back_scan;
+		if (regexec(&pattern, fline(pos), 0, NULL, 0) == 0) {
+			match_lines = xrealloc_vector(match_lines, 4, num_matches);
+			memmove(&match_lines[num_back + 1], &match_lines[num_back],
+				(num_matches - num_back) * sizeof(match_lines[0]));
+			match_lines[num_back] = pos;
+			if (match_pos >= num_back)
+				match_pos++;
+			num_back++;
+			num_matches++;
+		}
+		back_scan++;
+		count--;
 	}
 }
 
@@ -1206,19 +1540,17 @@ static void regex_process(void)
 
 	pattern_valid = 1;
 	match_pos = 0;
-	fill_match_lines(0);
-	while (match_pos < num_matches) {
-		if ((int)match_lines[match_pos] > cur_fline)
-			break;
-		match_pos++;
-	}
-	if (option_mask32 & LESS_STATE_MATCH_BACKWARDS)
-		match_pos--;
+	/* Search starts below the current line and goes only until
+	 * the first match; the rest of the file (including lines above
+	 * the current one) is searched while waiting for keypresses */
+	match_start = match_scan = cur_fline + 1;
+	back_scan = 0;
+	num_back = 0;
 
 	/* It's possible that no matches are found yet.
 	 * goto_match() will read input looking for match,
 	 * if needed */
-	goto_match(match_pos);
+	goto_match((option_mask32 & LESS_STATE_MATCH_BACKWARDS) ? -1 : 0);
 }
 #endif
 
@@ -1249,7 +1581,7 @@ static void number_process(int first_digit)
 	num_input[i] = '\0';
 	num = bb_strtou(num_input, NULL, 10);
 	/* on format error, num == -1 */
-	if (num < 1 || num > MAXLINES) {
+	if (num < 1 || num > MAX_FLINES) {
 		buffer_print();
 		return;
 	}
@@ -1379,7 +1711,7 @@ static void save_input_to_file(void)
 			goto ret;
 		}
 		for (i = 0; i <= max_fline; i++)
-			fprintf(fp, "%s\n", flines[i]);
+			fprintf(fp, "%s\n", fline(i));
 		fclose(fp);
 		msg = "Done";
 	}
@@ -1453,13 +1785,13 @@ static void match_right_bracket(char bracket)
 {
 	unsigned i;
 
-	if (strchr(flines[cur_fline], bracket) == NULL) {
+	if (strchr(fline(cur_fline), bracket) == NULL) {
 		print_statusline("No bracket in top line");
 		return;
 	}
 	bracket = opp_bracket(bracket);
 	for (i = cur_fline + 1; i < max_fline; i++) {
-		if (strchr(flines[i], bracket) != NULL) {
+		if (strchr(fline(i), bracket) != NULL) {
 			buffer_line(i);
 			return;
 		}
@@ -1471,14 +1803,14 @@ static void match_left_bracket(char bracket)
 {
 	int i;
 
-	if (strchr(flines[cur_fline + max_displayed_line], bracket) == NULL) {
+	if (strchr(fline(cur_fline + max_displayed_line), bracket) == NULL) {
 		print_statusline("No bracket in bottom line");
 		return;
 	}
 
 	bracket = opp_bracket(bracket);
 	for (i = cur_fline + max_displayed_line; i >= 0; i--) {
-		if (strchr(flines[i], bracket) != NULL) {
+		if (strchr(fline(i), bracket) != NULL) {
 			buffer_line(i);
 			return;
 		}
@@ -1512,7 +1844,7 @@ static void keypress_process(int keypress)
 		buffer_line(0);
 		break;
 	case KEYCODE_END: case 'G': case '>':
-		cur_fline = MAXLINES;
+		cur_fline = MAX_FLINES;
 		read_lines();
 		buffer_line(cur_fline);
 		break;
@@ -40,6 +40,7 @@
 #include <setjmp.h>
 #include <fnmatch.h>
 #include <sys/times.h>
+#include <sys/syscall.h>
 
 #include "busybox.h" /* for applet_names */
 #include "unicode.h"
@@ -113,6 +114,15 @@
 //config:	help
 //config:	  Enable alias support in the ash shell.
 //config:
+//config:config ASH_DOT_CACHE
+//config:	bool "Cache parsed '.' scripts"
+//config:	default y
+//config:	depends on ASH
+//config:	help
+//config:	  Keep the parse trees of files run with '.' in memory, keyed
+//config:	  by device, inode, size and timestamps. Sourcing an unchanged
+//config:	  file again evaluates the cached trees instead of reparsing it.
+//config:
 //config:config ASH_GETOPTS
 //config:	bool "Builtin getopt to parse positional parameters"
 //config:	default y
@@ -195,9 +205,11 @@
 
 /* ============ Hash table sizes. Configurable. */
 
-#define VTABSIZE 39
-#define ATABSIZE 39
-#define CMDTABLESIZE 31         /* should be prime */
+/* Initial sizes, must be powers of 2.
+ * Tables double when they hold more entries than buckets. */
+#define VTABSIZE 64
+#define ATABSIZE 16
+#define CMDTABLESIZE 32
 
 
 /* ============ Shell options */
@@ -654,6 +666,7 @@ union node;
 
 struct ncmd {
 	smallint type; /* Nxxxx */
+	int linno;
 	union node *assign;
 	union node *args;
 	union node *redirect;
@@ -1934,7 +1947,9 @@ struct globals_var {
 	struct redirtab *redirlist;
 	int g_nullredirs;
 	int preverrout_fd;   /* save fd2 before print debug if xflag is set. */
-	struct var *vartab[VTABSIZE];
+	unsigned vtabsize;
+	unsigned varcount;
+	struct var **vartab;
 	struct var varinit[ARRAY_SIZE(varinit_data)];
 };
 extern struct globals_var *const ash_ptr_to_globals_var;
@@ -1943,12 +1958,16 @@ extern struct globals_var *const ash_ptr_to_globals_var;
 //#define redirlist     (G_var.redirlist    )
 #define g_nullredirs  (G_var.g_nullredirs )
 #define preverrout_fd (G_var.preverrout_fd)
+#define vtabsize      (G_var.vtabsize     )
+#define varcount      (G_var.varcount     )
 #define vartab        (G_var.vartab       )
 #define varinit       (G_var.varinit      )
 #define INIT_G_var() do { \
 	unsigned i; \
 	(*(struct globals_var**)&ash_ptr_to_globals_var) = xzalloc(sizeof(G_var)); \
 	barrier(); \
+	vtabsize = VTABSIZE; \
+	vartab = xzalloc(VTABSIZE * sizeof(vartab[0])); \
 	for (i = 0; i < ARRAY_SIZE(varinit_data); i++) { \
 		varinit[i].flags    = varinit_data[i].flags; \
 		varinit[i].var_text = varinit_data[i].var_text; \
@@ -2052,18 +2071,52 @@ varcmp(const char *p, const char *q)
 	return c - d;
 }
 
+/*
+ * Hash function for variable, alias and command tables (FNV-1a).
+ * Stops at '=' so that "name=value" hashes the same as "name".
+ */
+static unsigned
+hashname(const char *p)
+{
+	unsigned hashval = 2166136261U;
+
+	while (*p && *p != '=')
+		hashval = (hashval ^ (unsigned char) *p++) * 16777619;
+	return hashval;
+}
+
 /*
  * Find the appropriate entry in the hash table from the name.
  */
 static struct var **
 hashvar(const char *p)
 {
-	unsigned hashval;
+	return &vartab[hashname(p) & (vtabsize - 1)];
+}
 
-	hashval = ((unsigned char) *p) << 4;
-	while (*p && *p != '=')
-		hashval += (unsigned char) *p++;
-	return &vartab[hashval % VTABSIZE];
+/*
+ * Double the variable hash table.
+ * Called with interrupts off.
+ */
+static void
+growvartab(void)
+{
+	struct var **newtab;
+	struct var *vp, *next;
+	unsigned i;
+
+	newtab = ckzalloc(2 * vtabsize * sizeof(newtab[0]));
+	for (i = 0; i < vtabsize; i++) {
+		for (vp = vartab[i]; vp; vp = next) {
+			struct var **vpp = &newtab[hashname(vp->var_text) & (2 * vtabsize - 1)];
+			next = vp->next;
+			vp->next = *vpp;
+			*vpp = vp;
+		}
+	}
+	free(vartab);
+	vartab = newtab;
+	vtabsize *= 2;
 }
 
 static int
@@ -2098,6 +2151,7 @@ initvar(void)
 		vp->next = *vpp;
 		*vpp = vp;
 	} while (++vp < end);
+	varcount = ARRAY_SIZE(varinit);
 }
 
 static struct var **
@@ -2191,6 +2245,10 @@ setvareq(char *s, int flags)
 		/* variable s is not found */
 		if (flags & VNOSET)
 			return;
+		if (++varcount > vtabsize) {
+			growvartab();
+			vpp = hashvar(s);
+		}
 		vp = ckzalloc(sizeof(*vp));
 		vp->next = *vpp;
 		/*vp->func = NULL; - ckzalloc did it */
@@ -2301,6 +2359,7 @@ unsetvar(const char *s)
 				free((char*)vp->var_text);
 			*vpp = vp->next;
 			free(vp);
+			varcount--;
 			INT_ON;
 		} else {
 			setvar(s, 0, 0);
@@ -2353,7 +2412,7 @@ listvars(int on, int off, char ***end)
 				*ep++ = (char*)vp->var_text;
 			}
 		}
-	} while (++vpp < vartab + VTABSIZE);
+	} while (++vpp < vartab + vtabsize);
 	if (ep == stackstrend())
 		ep = growstackstr();
 	if (end)
@@ -3134,28 +3193,22 @@ struct alias {
 };
 
 
-static struct alias **atab; // [ATABSIZE];
+static struct alias **atab; // [atabsize];
+static unsigned atabsize;
+static unsigned aliascount;
+/* Bumped when aliases change or get substituted, see dotcmd */
+static unsigned alias_gen;
 #define INIT_G_alias() do { \
+	atabsize = ATABSIZE; \
 	atab = xzalloc(ATABSIZE * sizeof(atab[0])); \
 } while (0)
 
 
 static struct alias **
 __lookupalias(const char *name) {
-	unsigned int hashval;
 	struct alias **app;
-	const char *p;
-	unsigned int ch;
-
-	p = name;
 
-	ch = (unsigned char)*p;
-	hashval = ch << 4;
-	while (ch) {
-		hashval += ch;
-		ch = (unsigned char)*++p;
-	}
-	app = &atab[hashval % ATABSIZE];
+	app = &atab[hashname(name) & (atabsize - 1)];
 
 	for (; *app; app = &(*app)->next) {
 		if (strcmp(name, (*app)->name) == 0) {
@@ -3190,9 +3243,32 @@ freealias(struct alias *ap)
 	free(ap->name);
 	free(ap->val);
 	free(ap);
+	aliascount--;
 	return next;
 }
 
+/* Called with interrupts off */
+static void
+growatab(void)
+{
+	struct alias **newtab;
+	struct alias *ap, *next;
+	unsigned i;
+
+	newtab = ckzalloc(2 * atabsize * sizeof(newtab[0]));
+	for (i = 0; i < atabsize; i++) {
+		for (ap = atab[i]; ap; ap = next) {
+			struct alias **app = &newtab[hashname(ap->name) & (2 * atabsize - 1)];
+			next = ap->next;
+			ap->next = *app;
+			*app = ap;
+		}
+	}
+	free(atab);
+	atab = newtab;
+	atabsize *= 2;
+}
+
 static void
 setalias(const char *name, const char *val)
 {
@@ -3201,6 +3277,7 @@ setalias(const char *name, const char *val)
 	app = __lookupalias(name);
 	ap = *app;
 	INT_OFF;
+	alias_gen++;
 	if (ap) {
 		if (!(ap->flag & ALIASINUSE)) {
 			free(ap->val);
@@ -3209,6 +3286,10 @@ setalias(const char *name, const char *val)
 		ap->flag &= ~ALIASDEAD;
 	} else {
 		/* not found */
+		if (++aliascount > atabsize) {
+			growatab();
+			app = __lookupalias(name);
+		}
 		ap = ckzalloc(sizeof(struct alias));
 		ap->name = ckstrdup(name);
 		ap->val = ckstrdup(val);
@@ -3229,6 +3310,7 @@ unalias(const char *name)
 	if (*app) {
 		INT_OFF;
 		*app = freealias(*app);
+		alias_gen++;
 		INT_ON;
 		return 0;
 	}
@@ -3243,7 +3325,8 @@ rmaliases(void)
 	int i;
 
 	INT_OFF;
-	for (i = 0; i < ATABSIZE; i++) {
+	alias_gen++;
+	for (i = 0; i < atabsize; i++) {
 		app = &atab[i];
 		for (ap = *app; ap; ap = *app) {
 			*app = freealias(*app);
@@ -3272,9 +3355,9 @@ aliascmd(int argc UNUSED_PARAM, char **argv)
 	struct alias *ap;
 
 	if (!argv[1]) {
-		int i;
+		unsigned i;
 
-		for (i = 0; i < ATABSIZE; i++) {
+		for (i = 0; i < atabsize; i++) {
 			for (ap = atab[i]; ap; ap = ap->next) {
 				printalias(ap);
 			}
@@ -3320,6 +3403,8 @@ unaliascmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 	return i;
 }
 
+#else
+#define alias_gen 0
 #endif /* ASH_ALIAS */
 
 
@@ -4876,8 +4961,12 @@ forkshell(struct job *jp, union node *n, int mode)
 	}
 	if (pid == 0) {
 		CLEAR_RANDOM_T(&random_gen); /* or else $RANDOM repeats in child */
+		if (sh_prof_enabled)
+			sh_prof_disable();
 		forkchild(jp, n, mode);
 	} else {
+		if (sh_prof_enabled)
+			sh_prof_fork(!n || n->type != NCMD);
 		forkparent(jp, n, mode, pid);
 	}
 	return pid;
@@ -5845,6 +5934,7 @@ struct backcmd {                /* result of evalbackcmd */
 static uint8_t back_exitstatus; /* exit status of backquoted command */
 #define EV_EXIT 01              /* exit after evaluating tree */
 static void evaltree(union node *, int);
+static int evalbackcmd_nofork(union node *, struct backcmd *);
 
 static void FAST_FUNC
 evalbackcmd(union node *n, struct backcmd *result)
@@ -5857,6 +5947,8 @@ evalbackcmd(union node *n, struct backcmd *result)
 	result->jp = NULL;
 	if (n == NULL)
 		goto out;
+	if (evalbackcmd_nofork(n, result))
+		goto out;
 
 	saveherefd = herefd;
 	herefd = -1;
@@ -5912,6 +6004,8 @@ expbackq(union node *cmd, int quoted, int quotes)
 	grabstackstr(dest);
 	evalbackcmd(cmd, &in);
 	popstackmark(&smark);
+	/* evalbackcmd() may have expanded words in-process, moving the stack */
+	expdest = (char *)stackblock() + startloc;
 
 	p = in.buf;
 	i = in.nleft;
@@ -7388,8 +7482,11 @@ struct tblentry {
 	char cmdname[1];        /* name of command */
 };
 
-static struct tblentry **cmdtable;
+static struct tblentry **cmdtable; // [cmdtablesize];
+static unsigned cmdtablesize;
+static unsigned cmdcount;
 #define INIT_G_cmdtable() do { \
+	cmdtablesize = CMDTABLESIZE; \
 	cmdtable = xzalloc(CMDTABLESIZE * sizeof(cmdtable[0])); \
 } while (0)
 
@@ -7552,7 +7649,7 @@ clearcmdentry(int firstchange)
 	struct tblentry *cmdp;
 
 	INT_OFF;
-	for (tblp = cmdtable; tblp < &cmdtable[CMDTABLESIZE]; tblp++) {
+	for (tblp = cmdtable; tblp < &cmdtable[cmdtablesize]; tblp++) {
 		pp = tblp;
 		while ((cmdp = *pp) != NULL) {
 			if ((cmdp->cmdtype == CMDNORMAL &&
@@ -7562,6 +7659,7 @@ clearcmdentry(int firstchange)
 			) {
 				*pp = cmdp->next;
 				free(cmdp);
+				cmdcount--;
 			} else {
 				pp = &cmdp->next;
 			}
@@ -7581,26 +7679,46 @@ clearcmdentry(int firstchange)
  */
 static struct tblentry **lastcmdentry;
 
+static void
+growcmdtable(void)
+{
+	struct tblentry **newtab;
+	struct tblentry *cmdp, *next;
+	unsigned i;
+
+	newtab = ckzalloc(2 * cmdtablesize * sizeof(newtab[0]));
+	for (i = 0; i < cmdtablesize; i++) {
+		for (cmdp = cmdtable[i]; cmdp; cmdp = next) {
+			struct tblentry **pp = &newtab[hashname(cmdp->cmdname) & (2 * cmdtablesize - 1)];
+			next = cmdp->next;
+			cmdp->next = *pp;
+			*pp = cmdp;
+		}
+	}
+	free(cmdtable);
+	cmdtable = newtab;
+	cmdtablesize *= 2;
+}
+
 static struct tblentry *
 cmdlookup(const char *name, int add)
 {
-	unsigned int hashval;
-	const char *p;
 	struct tblentry *cmdp;
 	struct tblentry **pp;
 
-	p = name;
-	hashval = (unsigned char)*p << 4;
-	while (*p)
-		hashval += (unsigned char)*p++;
-	hashval &= 0x7FFF;
-	pp = &cmdtable[hashval % CMDTABLESIZE];
+	pp = &cmdtable[hashname(name) & (cmdtablesize - 1)];
 	for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 		if (strcmp(cmdp->cmdname, name) == 0)
 			break;
 		pp = &cmdp->next;
 	}
 	if (add && cmdp == NULL) {
+		if (++cmdcount > cmdtablesize) {
+			growcmdtable();
+			pp = &cmdtable[hashname(name) & (cmdtablesize - 1)];
+			while (*pp)
+				pp = &(*pp)->next;
+		}
 		cmdp = *pp = ckzalloc(sizeof(struct tblentry)
 				+ strlen(name)
 				/* + 1 - already done because
@@ -7627,6 +7745,7 @@ delete_cmd_entry(void)
 	if (cmdp->cmdtype == CMDFUNCTION)
 		freefunc(cmdp->param.func);
 	free(cmdp);
+	cmdcount--;
 	INT_ON;
 }
 
@@ -7663,7 +7782,7 @@ hashcmd(int argc UNUSED_PARAM, char **argv UNUSED_PARAM)
 	}
 
 	if (*argptr == NULL) {
-		for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+		for (pp = cmdtable; pp < &cmdtable[cmdtablesize]; pp++) {
 			for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 				if (cmdp->cmdtype == CMDNORMAL)
 					printentry(cmdp);
@@ -7699,7 +7818,7 @@ hashcd(void)
 	struct tblentry **pp;
 	struct tblentry *cmdp;
 
-	for (pp = cmdtable; pp < &cmdtable[CMDTABLESIZE]; pp++) {
+	for (pp = cmdtable; pp < &cmdtable[cmdtablesize]; pp++) {
 		for (cmdp = *pp; cmdp; cmdp = cmdp->next) {
 			if (cmdp->cmdtype == CMDNORMAL
 			 || (cmdp->cmdtype == CMDBUILTIN
@@ -8165,6 +8284,7 @@ copynode(union node *n)
 		new->ncmd.redirect = copynode(n->ncmd.redirect);
 		new->ncmd.args = copynode(n->ncmd.args);
 		new->ncmd.assign = copynode(n->ncmd.assign);
+		new->ncmd.linno = n->ncmd.linno;
 		break;
 	case NPIPE:
 		new->npipe.cmdlist = copynodelist(n->npipe.cmdlist);
@@ -8872,8 +8992,12 @@ evalfun(struct funcnode *func, int argc, char **argv, int flags)
 	shellparam.optind = 1;
 	shellparam.optoff = -1;
 #endif
+	if (sh_prof_enabled)
+		sh_prof_func_enter(argv[0]);
 	evaltree(&func->n, flags & EV_TESTED);
  funcdone:
+	if (sh_prof_enabled)
+		sh_prof_func_leave();
 	INT_OFF;
 	funcnest--;
 	freefunc(func);
@@ -8953,7 +9077,8 @@ mklocal(char *name)
 				setvareq(name, VSTRFIXED);
 			else
 				setvar(name, NULL, VSTRFIXED);
-			vp = *vpp;      /* the new variable */
+			/* the new variable (table may have been resized) */
+			vp = *findvar(hashvar(name), name);
 			lvp->flags = VUNSET;
 		} else {
 			lvp->text = vp->var_text;
@@ -9222,6 +9347,8 @@ evalcommand(union node *cmd, int flags)
 
 	/* First expand the arguments. */
 	TRACE(("evalcommand(0x%lx, %d) called\n", (long)cmd, flags));
+	if (sh_prof_enabled)
+		sh_prof_line(commandname ? commandname : arg0, cmd->ncmd.linno);
 	setstackmark(&smark);
 	back_exitstatus = 0;
 
@@ -9479,6 +9606,208 @@ evalbltin(const struct builtincmd *cmd, int argc, char **argv)
 	return i;
 }
 
+/*
+ * Can "$(cmd args)" be run without forking a subshell?
+ * Expanding the arguments must not change shell state: no ${var=...},
+ * no arithmetic (which may assign), no ${var:pos:len} (arithmetic too).
+ * Nested $(...) are fine, they run in their own (sub)shell.
+ */
+static int
+backq_arg_is_pure(const char *p)
+{
+	for (; *p; p++) {
+		switch ((unsigned char)*p) {
+		case CTLESC:
+			p++;
+			break;
+		case CTLVAR:
+			p++;
+			if ((*p & VSTYPE) == VSASSIGN
+#if ENABLE_ASH_BASH_COMPAT
+			 || (*p & VSTYPE) == VSSUBSTR
+#endif
+			) {
+				return 0;
+			}
+			break;
+		case CTLARI:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Builtins which only produce output and do not touch shell state */
+static int
+backq_builtin_is_pure(const struct builtincmd *cmd)
+{
+	int FAST_FUNC (*f)(int, char **) = cmd->builtin;
+
+	return f == truecmd || f == falsecmd || f == pwdcmd || f == typecmd
+		IF_ASH_BUILTIN_ECHO(|| f == echocmd)
+		IF_ASH_BUILTIN_PRINTF(|| f == printfcmd)
+		IF_ASH_BUILTIN_TEST(|| f == testcmd)
+	;
+}
+
+/*
+ * "$(echo ...)", "$(basename ...)" etc: run a simple command which is
+ * a pure builtin or a NOFORK applet in this process, with its stdout
+ * captured in a memfd, and hand the output back in result->buf.
+ * Returns 0 if the command has to be forked off as usual.
+ */
+static int
+evalbackcmd_nofork(union node *n, struct backcmd *result)
+{
+	struct arglist arglist;
+	struct cmdentry entry;
+	struct strlist *sp;
+	union node *argp;
+	const char *name;
+	const char *p;
+	char **argv;
+	int argc;
+#if ENABLE_FEATURE_SH_NOFORK
+	int applet_no;
+#endif
+	int fd;
+	int savefd;
+	int status;
+	int saveexit;
+	int saveint;
+	int raised;
+	off_t size;
+	struct nodelist *saveargbackq;
+	struct ifsregion saveifsfirst;
+	struct ifsregion *saveifslastp;
+	struct jmploc *volatile savehandler;
+	struct jmploc jmploc;
+
+	if (n->type != NCMD || n->ncmd.assign || n->ncmd.redirect
+	 || !n->ncmd.args || xflag
+	) {
+		return 0;
+	}
+	/* Command name must be a plain word, we look it up before expanding */
+	name = n->ncmd.args->narg.text;
+	for (p = name; *p; p++) {
+		unsigned char c = *p;
+		if ((c >= CTL_FIRST && c <= CTL_LAST) || strchr("*?~", c))
+			return 0;
+		if (c == '[' && strcmp(name, "[") != 0 && strcmp(name, "[[") != 0)
+			return 0;
+	}
+	for (argp = n->ncmd.args; argp; argp = argp->narg.next) {
+		if (!backq_arg_is_pure(argp->narg.text))
+			return 0;
+	}
+
+	find_command((char *)name, &entry, 0, pathval());
+#if ENABLE_FEATURE_SH_NOFORK
+	applet_no = -1;
+	if (entry.cmdtype == CMDNORMAL) {
+		/* find_command() encodes applet_no as (-2 - applet_no) */
+		applet_no = - entry.u.index - 2;
+		if (applet_no < 0 || !APPLET_IS_NOFORK(applet_no))
+			return 0;
+	} else
+#endif
+	if (entry.cmdtype != CMDBUILTIN || !backq_builtin_is_pure(entry.u.cmd)) {
+		return 0;
+	}
+
+#ifdef __NR_memfd_create
+	fd = syscall(__NR_memfd_create, "ash", 1 /* MFD_CLOEXEC */);
+#else
+	fd = -1;
+#endif
+	if (fd < 0)
+		return 0;
+
+	fflush_all();
+	savefd = fcntl(1, F_DUPFD, 10);
+	if (savefd >= 0) {
+		close_on_exec_on(savefd);
+	} else if (errno != EBADF) {
+		close(fd);
+		return 0;
+	}
+	SAVE_INT(saveint);
+	saveexit = exitstatus;
+	/* We are called from the middle of argstr(), save its state */
+	saveargbackq = argbackq;
+	saveifsfirst = ifsfirst;
+	saveifslastp = ifslastp;
+	savehandler = exception_handler;
+	raised = 0;
+	if (setjmp(jmploc.loc)) {
+		/* Expansion or the builtin failed. A subshell would exit with 2 */
+		raised = 1;
+		status = 2;
+		goto restore;
+	}
+	exception_handler = &jmploc;
+
+	arglist.lastp = &arglist.list;
+	argc = 0;
+	for (argp = n->ncmd.args; argp; argp = argp->narg.next)
+		expandarg(argp, &arglist, EXP_FULL | EXP_TILDE);
+	*arglist.lastp = NULL;
+	for (sp = arglist.list; sp; sp = sp->next)
+		argc++;
+	argv = stalloc(sizeof(char *) * (argc + 1));
+	argc = 0;
+	for (sp = arglist.list; sp; sp = sp->next)
+		argv[argc++] = sp->text;
+	argv[argc] = NULL;
+
+	dup2(fd, 1);
+#if ENABLE_FEATURE_SH_NOFORK
+	if (applet_no >= 0) {
+		status = run_nofork_applet(applet_no, argv);
+	} else
+#endif
+	{
+		if (evalbltin(entry.u.cmd, argc, argv))
+			longjmp(exception_handler->loc, 1);
+		status = exitstatus;
+	}
+ restore:
+	exception_handler = savehandler;
+	fflush_all();
+	if (savefd >= 0) {
+		dup2(savefd, 1);
+		close(savefd);
+	} else {
+		close(1);
+	}
+	exitstatus = saveexit;
+	if (ifsfirst.next)
+		ifsfree();
+	argbackq = saveargbackq;
+	ifsfirst = saveifsfirst;
+	ifslastp = saveifslastp;
+	if (raised) {
+		if (exception_type != EXERROR) {
+			/* ^C or a signal: pass it on */
+			close(fd);
+			longjmp(exception_handler->loc, 1);
+		}
+		RESTORE_INT(saveint);
+	}
+
+	size = lseek(fd, 0, SEEK_CUR);
+	if (size > 0) {
+		result->buf = ckmalloc(size);
+		result->nleft = pread(fd, result->buf, size, 0);
+		if (result->nleft < 0)
+			result->nleft = 0;
+	}
+	close(fd);
+	back_exitstatus = status;
+	return 1;
+}
+
 static int
 goodname(const char *p)
 {
@@ -10747,6 +11076,7 @@ simplecmd(void)
 	union node *vars, **vpp;
 	union node **rpp, *redir;
 	int savecheckkwd;
+	int linno;
 #if ENABLE_ASH_BASH_COMPAT
 	smallint double_brackets_flag = 0;
 #endif
@@ -10759,10 +11089,13 @@ simplecmd(void)
 	rpp = &redir;
 
 	savecheckkwd = CHKALIAS;
+	linno = 0;
 	for (;;) {
 		int t;
 		checkkwd = savecheckkwd;
 		t = readtoken();
+		if (!linno)
+			linno = startlinno;
 		switch (t) {
 #if ENABLE_ASH_BASH_COMPAT
 		case TAND: /* "&&" */
@@ -10832,6 +11165,7 @@ simplecmd(void)
 	*rpp = NULL;
 	n = stzalloc(sizeof(struct ncmd));
 	n->type = NCMD;
+	n->ncmd.linno = linno;
 	n->ncmd.args = args;
 	n->ncmd.assign = vars;
 	n->ncmd.redirect = redir;
@@ -11982,6 +12316,8 @@ readtoken(void)
 		struct alias *ap;
 		ap = lookupalias(wordtext, 1);
 		if (ap != NULL) {
+			/* parse depends on aliases now, see dotcmd */
+			alias_gen++;
 			if (*ap->val) {
 				pushstring(ap->val, ap);
 			}
@@ -12141,6 +12477,153 @@ evalcmd(int argc UNUSED_PARAM, char **argv)
 	return exitstatus;
 }
 
+#if ENABLE_ASH_DOT_CACHE
+/*
+ * Parse trees of '.' scripts. A file is recorded command by command
+ * while cmdloop() runs it; once it was read to EOF the copies are kept,
+ * and the next '.' of the same unchanged file just evaluates them.
+ */
+enum { DOTCACHE_MAX = 16 };
+
+struct dotscript {
+	struct dotscript *next;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct timespec ctime;
+	unsigned alias_gen;     /* aliases used/changed while parsing => stale */
+	int busy;               /* being evaluated, don't free */
+	int ncmds;
+	smallint complete;      /* read up to EOF */
+	struct dotcmd {
+		struct funcnode *func;
+		int linno;
+	} *cmds;
+};
+
+static struct dotscript *dotcache;
+static struct dotscript *dot_recording;
+
+static void
+dotscript_free(struct dotscript *ds)
+{
+	int i;
+
+	for (i = 0; i < ds->ncmds; i++)
+		free(ds->cmds[i].func);
+	free(ds->cmds);
+	free(ds);
+}
+
+static void
+dotscript_add(struct dotscript *ds, union node *n)
+{
+	if (n == NODE_EOF) {
+		ds->complete = 1;
+		return;
+	}
+	if (n == NULL)
+		return;
+	INT_OFF;
+	if (!(ds->ncmds & 31))
+		ds->cmds = ckrealloc(ds->cmds, (ds->ncmds + 32) * sizeof(ds->cmds[0]));
+	ds->cmds[ds->ncmds].func = copyfunc(n);
+	ds->cmds[ds->ncmds].linno = startlinno;
+	ds->ncmds++;
+	INT_ON;
+}
+
+static int
+dotscript_matches(struct dotscript *ds, const struct stat *st)
+{
+	return ds->dev == st->st_dev && ds->ino == st->st_ino
+		&& ds->size == st->st_size
+		&& ds->mtime.tv_sec == st->st_mtim.tv_sec
+		&& ds->mtime.tv_nsec == st->st_mtim.tv_nsec
+		&& ds->ctime.tv_sec == st->st_ctim.tv_sec
+		&& ds->ctime.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+/*
+ * Find the cached trees for the file open on fd, dropping stale ones.
+ * Returns NULL if it has to be parsed; *recp is then set to a fresh
+ * recording if the file is worth caching.
+ */
+static struct dotscript *
+dotcache_lookup(int fd, struct dotscript **recp)
+{
+	struct dotscript *ds, **dsp;
+	struct stat st;
+	int cnt;
+
+	*recp = NULL;
+	if (vflag || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+		return NULL;
+
+	cnt = 0;
+	for (dsp = &dotcache; (ds = *dsp) != NULL;) {
+		if (ds->dev == st.st_dev && ds->ino == st.st_ino) {
+			if (dotscript_matches(ds, &st) && ds->alias_gen == alias_gen) {
+				/* move to front */
+				*dsp = ds->next;
+				ds->next = dotcache;
+				dotcache = ds;
+				return ds;
+			}
+			if (ds->busy) /* running it now, and it was changed?! */
+				return NULL;
+			*dsp = ds->next;
+			dotscript_free(ds);
+			continue;
+		}
+		if (++cnt >= DOTCACHE_MAX && !ds->busy) {
+			*dsp = ds->next;
+			dotscript_free(ds);
+			continue;
+		}
+		dsp = &ds->next;
+	}
+
+	ds = ckzalloc(sizeof(*ds));
+	ds->dev = st.st_dev;
+	ds->ino = st.st_ino;
+	ds->size = st.st_size;
+	ds->mtime = st.st_mtim;
+	ds->ctime = st.st_ctim;
+	ds->alias_gen = alias_gen;
+	*recp = ds;
+	return NULL;
+}
+
+/* Like cmdloop(0), but on cached trees */
+static void
+dotscript_eval(struct dotscript *ds)
+{
+	struct stackmark smark;
+	int i;
+
+	for (i = 0; i < ds->ncmds; i++) {
+		setstackmark(&smark);
+#if JOBS
+		if (doing_jobctl)
+			showjobs(stderr, SHOW_CHANGED);
+#endif
+		if (nflag == 0) {
+			job_warning >>= 1;
+			/* error messages report the line the command ended on */
+			startlinno = ds->cmds[i].linno;
+			evaltree(&ds->cmds[i].func->n, 0);
+		}
+		popstackmark(&smark);
+		if (evalskip) {
+			evalskip = 0;
+			break;
+		}
+	}
+}
+#endif
+
 /*
  * Read and execute commands.
  * "Top" is nonzero for the top level command loop;
@@ -12172,6 +12655,10 @@ cmdloop(int top)
 #if DEBUG
 		if (DEBUG > 2 && debug && (n != NODE_EOF))
 			showtree(n);
+#endif
+#if ENABLE_ASH_DOT_CACHE
+		if (dot_recording && !top)
+			dotscript_add(dot_recording, n);
 #endif
 		if (n == NODE_EOF) {
 			if (!top || numeof >= 50)
@@ -12269,9 +12756,57 @@ dotcmd(int argc, char **argv)
 		shellparam.p = argv;
 	};
 
+#if ENABLE_ASH_DOT_CACHE
+	{
+		struct dotscript *volatile ds;
+		struct dotscript *volatile rec;
+		struct dotscript *saverec;
+		struct jmploc *volatile savehandler;
+		struct jmploc jmploc;
+		struct dotscript *r;
+
+		ds = dotcache_lookup(setinputfile(fullname, INPUT_PUSH_FILE), &r);
+		rec = r;
+		commandname = fullname;
+		saverec = dot_recording;
+		savehandler = exception_handler;
+		if (setjmp(jmploc.loc)) {
+			exception_handler = savehandler;
+			dot_recording = saverec;
+			if (ds)
+				ds->busy--;
+			if (rec)
+				dotscript_free(rec);
+			longjmp(exception_handler->loc, 1);
+		}
+		exception_handler = &jmploc;
+		if (ds) {
+			ds->busy++;
+			dotscript_eval(ds);
+			ds->busy--;
+		} else {
+			dot_recording = rec;
+			cmdloop(0);
+			dot_recording = saverec;
+			if (rec && rec->complete && rec->alias_gen == alias_gen) {
+				rec->next = dotcache;
+				dotcache = rec;
+				rec = NULL;
+			}
+			if (rec) {
+				INT_OFF;
+				dotscript_free(rec);
+				rec = NULL;
+				INT_ON;
+			}
+		}
+		exception_handler = savehandler;
+	}
+#else
 	setinputfile(fullname, INPUT_PUSH_FILE);
 	commandname = fullname;
 	cmdloop(0);
+#endif
 	popfile();
 
 	if (argc) {
@@ -12927,6 +13462,8 @@ exitshell(void)
 	}
 	flush_stdout_stderr();
  out:
+	if (sh_prof_enabled)
+		sh_prof_finish();
 	setjobctl(0);
 	_exit(status);
 	/* NOTREACHED */
@@ -13111,6 +13648,8 @@ int ash_main(int argc UNUSED_PARAM, char **argv)
 	/* Initialize global data */
 	INIT_G_misc();
 	INIT_G_memstack();
+	if (ENABLE_FEATURE_SH_PROFILE)
+		sh_prof_init(); /* before we import environment */
 	INIT_G_var();
 #if ENABLE_ASH_ALIAS
 	INIT_G_alias();
@@ -238,6 +238,22 @@ typedef void (*hush_sighandler_t)(int);
 //config:	  This instructs hush to print commands before execution.
 //config:	  Adds ~300 bytes.
 //config:
+//config:config HUSH_NOFORK_APPLETS
+//config:	string "Also run these applets without forking"
+//config:	default "cut expr head tr wc"
+//config:	depends on HUSH && FEATURE_SH_NOFORK
+//config:	help
+//config:	  Space-separated list of applets which are not marked NOFORK,
+//config:	  but which hush may nevertheless call in its own process when
+//config:	  they are run as a simple command (not in a pipe, not in
+//config:	  background). This saves a fork+exec per call in scripts
+//config:	  which use them in loops.
+//config:
+//config:	  Listed applets must obey the NOFORK rules from
+//config:	  docs/nofork_noexec.txt, except that reading stdin via
+//config:	  fopen_or_warn_stdin() is allowed: in a NOFORK applet it gets
+//config:	  a private FILE. Leave it empty if unsure.
+//config:
 //config:config MSH
 //config:	bool "msh (deprecated: aliased to hush)"
 //config:	default n
@@ -469,6 +485,9 @@ typedef struct in_str {
 	smallint promptmode; /* 0: PS1, 1: PS2 */
 #endif
 	int last_char;
+#if ENABLE_FEATURE_SH_PROFILE
+	unsigned lineno; /* newlines before last_char */
+#endif
 	FILE *file;
 	int (*get) (struct in_str *) FAST_FUNC;
 	int (*peek) (struct in_str *) FAST_FUNC;
@@ -492,6 +511,19 @@ static const struct {
 /*	{ O_RDONLY,                 77, "<<" }, */
 };
 
+/* Parse tree (pipes, commands, words, redirects) is allocated
+ * from an arena and freed in one go when the last reference
+ * to the arena is dropped: after the tree is executed,
+ * or when a function whose body lives there is unset.
+ */
+struct parse_arena {
+	char *pos;                  /* free space in current chunk */
+	char *end;
+	char *last;                 /* last block, can grow in place */
+	void **chunks;              /* chain of chunks, linked by chunk[0] */
+	unsigned refcnt;
+};
+
 struct redir_struct {
 	struct redir_struct *next;
 	char *rd_filename;          /* filename */
@@ -538,14 +570,18 @@ struct command {
 #endif
 
 	smalluint cmd_exitcode;
+#if ENABLE_FEATURE_SH_PROFILE
+	unsigned lineno;
+#endif
 	/* if non-NULL, this "command" is { list }, ( list ), or a compound statement */
 	struct pipe *group;
 #if !BB_MMU
 	char *group_as_string;
 #endif
 #if ENABLE_HUSH_FUNCTIONS
-	struct function *child_func;
-/* This field is used to prevent a bug here:
+	/* CMD_FUNCDEF: the arena this command (and function body) is in */
+	struct parse_arena *arena;
+/* struct function has ->parent_cmd to prevent a bug here:
  * while...do f1() {a;}; f1; f1() {b;}; f1; done
  * When we execute "f1() {a;}" cmd, we create new function and clear
  * cmd->group, cmd->group_as_string, cmd->argv[0].
@@ -556,8 +592,8 @@ struct command {
  * When we loop back, we can execute "f1() {a;}" again and set f1 correctly.
  * Without this trick, loop would execute a;b;b;b;...
  * instead of correct sequence a;b;a;b;...
- * When command is freed, it severs the link
- * (sets ->child_func->parent_cmd to NULL).
+ * The function holds a reference to cmd's arena, thus even after
+ * the loop is done and freed, ->parent_cmd stays valid.
  */
 #endif
 	char **argv;                /* command name and arguments */
@@ -660,6 +696,7 @@ struct function {
 	char *name;
 	struct command *parent_cmd;
 	struct pipe *body;
+	struct parse_arena *arena;  /* where body, name and parent_cmd are */
 # if !BB_MMU
 	char *body_as_string;
 # endif
@@ -792,6 +829,7 @@ struct globals {
 	const char *cwd;
 	struct variable *top_var;
 	char **expanded_assignments;
+	struct parse_arena *parse_arena; /* parse_stream allocates here */
 #if ENABLE_HUSH_FUNCTIONS
 	struct function *top_func;
 # if ENABLE_HUSH_LOCAL
@@ -821,6 +859,9 @@ struct globals {
 #endif
 	char **traps; /* char *traps[NSIG] */
 	sigset_t pending_set;
+#if ENABLE_FEATURE_SH_PROFILE
+	const char *prof_script; /* file being run, for profiler */
+#endif
 #if HUSH_DEBUG
 	unsigned long memleak_value;
 	int debug_indent;
@@ -1558,6 +1599,8 @@ static void hush_exit(int exitcode)
 		 * in the handler */
 		builtin_eval(argv);
 	}
+	if (sh_prof_enabled)
+		sh_prof_finish();
 
 #if ENABLE_FEATURE_CLEAN_UP
 	{
@@ -1980,6 +2023,7 @@ static int FAST_FUNC static_get(struct in_str *i)
 	int ch = *i->p;
 	if (ch != '\0') {
 		i->p++;
+		IF_FEATURE_SH_PROFILE(i->lineno += (i->last_char == '\n');)
 		i->last_char = ch;
 		return ch;
 	}
@@ -2109,6 +2153,7 @@ static int FAST_FUNC file_get(struct in_str *i)
 		do ch = fgetc(i->file); while (ch == '\0');
 	}
 	debug_printf("file_get: got '%c' %d\n", ch, ch);
+	IF_FEATURE_SH_PROFILE(i->lineno += (i->last_char == '\n');)
 	i->last_char = ch;
 	return ch;
 }
@@ -2182,7 +2227,14 @@ static ALWAYS_INLINE void o_free_unsafe(o_string *o)
 static void o_grow_by(o_string *o, int len)
 {
 	if (o->length + len > o->maxlen) {
-		o->maxlen += (2*len > B_CHUNK ? 2*len : B_CHUNK);
+		/* Grow by at least half: building a long string
+		 * char by char should not realloc/copy O(N) times */
+		int grow = o->maxlen / 2;
+		if (grow < B_CHUNK)
+			grow = B_CHUNK;
+		if (grow < 2*len)
+			grow = 2*len;
+		o->maxlen += grow;
 		o->data = xrealloc(o->data, 1 + o->maxlen);
 	}
 }
@@ -2713,88 +2765,131 @@ static char **o_finalize_list(o_string *o, int n)
 	return list;
 }
 
-static void free_pipe_list(struct pipe *pi);
+/*
+ * Parse tree memory
+ */
+/* 1k blocks minus malloc overhead: chunks should be reusable
+ * by other allocations (NOMMU does not like fragmentation) */
+#define ARENA_CHUNK (1024 - 4 * sizeof(void*))
+#define ARENA_ALIGN(n) (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
 
-/* Returns pi->next - next pipe in the list */
-static struct pipe *free_pipe(struct pipe *pi)
+static struct parse_arena *arena_new(void)
 {
-	struct pipe *next;
-	int i;
+	void **chunk = xmalloc(ARENA_CHUNK);
+	struct parse_arena *a = (void*)(chunk + 1);
 
-	debug_printf_clean("free_pipe (pid %d)\n", getpid());
-	for (i = 0; i < pi->num_cmds; i++) {
-		struct command *command;
-		struct redir_struct *r, *rnext;
+	chunk[0] = NULL;
+	a->chunks = chunk;
+	a->pos = (char*)(a + 1);
+	a->end = (char*)chunk + ARENA_CHUNK;
+	a->last = NULL;
+	a->refcnt = 1;
+	return a;
+}
 
-		command = &pi->cmds[i];
-		debug_printf_clean("  command %d:\n", i);
-		if (command->argv) {
-			if (DEBUG_CLEAN) {
-				int a;
-				char **p;
-				for (a = 0, p = command->argv; *p; a++, p++) {
-					debug_printf_clean("   argv[%d] = %s\n", a, *p);
-				}
-			}
-			free_strings(command->argv);
-			//command->argv = NULL;
-		}
-		/* not "else if": on syntax error, we may have both! */
-		if (command->group) {
-			debug_printf_clean("   begin group (cmd_type:%d)\n",
-					command->cmd_type);
-			free_pipe_list(command->group);
-			debug_printf_clean("   end group\n");
-			//command->group = NULL;
-		}
-		/* else is crucial here.
-		 * If group != NULL, child_func is meaningless */
 #if ENABLE_HUSH_FUNCTIONS
-		else if (command->child_func) {
-			debug_printf_exec("cmd %p releases child func at %p\n", command, command->child_func);
-			command->child_func->parent_cmd = NULL;
-		}
+static struct parse_arena *arena_ref(struct parse_arena *a)
+{
+	if (a)
+		a->refcnt++;
+	return a;
+}
 #endif
-#if !BB_MMU
-		free(command->group_as_string);
-		//command->group_as_string = NULL;
-#endif
-		for (r = command->redirects; r; r = rnext) {
-			debug_printf_clean("   redirect %d%s",
-					r->rd_fd, redir_table[r->rd_type].descrip);
-			/* guard against the case >$FOO, where foo is unset or blank */
-			if (r->rd_filename) {
-				debug_printf_clean(" fname:'%s'\n", r->rd_filename);
-				free(r->rd_filename);
-				//r->rd_filename = NULL;
-			}
-			debug_printf_clean(" rd_dup:%d\n", r->rd_dup);
-			rnext = r->next;
-			free(r);
-		}
-		//command->redirects = NULL;
+
+static void arena_unref(struct parse_arena *a)
+{
+	void **chunk;
+
+	if (!a || --a->refcnt != 0)
+		return;
+	/* First chunk (the one with *a in it) is the last in chain */
+	chunk = a->chunks;
+	do {
+		void **next = chunk[0];
+		free(chunk);
+		chunk = next;
+	} while (chunk);
+}
+
+/* Allocates from G.parse_arena */
+static void *arena_alloc(size_t size)
+{
+	struct parse_arena *a = G.parse_arena;
+	void **chunk;
+	char *p;
+
+	size = ARENA_ALIGN(size);
+	if ((size_t)(a->end - a->pos) < size) {
+		if (size > ARENA_CHUNK / 4) {
+			/* Big block (heredoc?) gets a chunk of its own,
+			 * current chunk stays in use */
+			chunk = xmalloc(sizeof(chunk[0]) + size);
+			chunk[0] = a->chunks;
+			a->chunks = chunk;
+			return chunk + 1;
+		}
+		chunk = xmalloc(ARENA_CHUNK);
+		chunk[0] = a->chunks;
+		a->chunks = chunk;
+		a->pos = (char*)(chunk + 1);
+		a->end = (char*)chunk + ARENA_CHUNK;
+	}
+	p = a->last = a->pos;
+	a->pos += size;
+	return p;
+}
+
+static void *arena_zalloc(size_t size)
+{
+	return memset(arena_alloc(size), 0, size);
+}
+
+/* Grows ptr (of old_size) in place if it is the last block,
+ * else moves it */
+static void *arena_realloc(void *ptr, size_t old_size, size_t size)
+{
+	struct parse_arena *a = G.parse_arena;
+	void *p;
+
+	if (ptr && ptr == a->last
+	 && (size_t)(a->end - a->last) >= ARENA_ALIGN(size)
+	) {
+		a->pos = a->last + ARENA_ALIGN(size);
+		return ptr;
 	}
-	free(pi->cmds);   /* children are an array, they get freed all at once */
-	//pi->cmds = NULL;
-#if ENABLE_HUSH_JOB
-	free(pi->cmdtext);
-	//pi->cmdtext = NULL;
-#endif
+	p = arena_alloc(size);
+	if (old_size)
+		memcpy(p, ptr, old_size);
+	return p;
+}
 
-	next = pi->next;
-	free(pi);
-	return next;
+static char *arena_strdup(const char *str)
+{
+	size_t len = strlen(str) + 1;
+	return memcpy(arena_alloc(len), str, len);
 }
 
-static void free_pipe_list(struct pipe *pi)
+/* Like add_string_to_strings, but in arena, and copies str.
+ * Vector size is a power of 2 (at least 4), so that adding N words
+ * to a command does not make N copies of it */
+static char **arena_add_string(char **strings, const char *str)
 {
-	while (pi) {
-#if HAS_KEYWORDS
-		debug_printf_clean("pipe reserved word %d\n", pi->res_word);
-#endif
-		debug_printf_clean("pipe followup code %d\n", pi->followup);
-		pi = free_pipe(pi);
+	unsigned count = 0;
+
+	if (strings) {
+		while (strings[count])
+			count++;
+	}
+	/* count+1 slots are used. Full if that's a power of 2, >= 4 */
+	if (!strings || (count >= 3 && ((count + 1) & count) == 0)) {
+		char **v = arena_alloc(sizeof(v[0]) * (count < 3 ? 4 : 2 * (count + 1)));
+		if (count)
+			memcpy(v, strings, sizeof(v[0]) * count);
+		strings = v;
 	}
+	strings[count] = arena_strdup(str);
+	strings[count + 1] = NULL;
+	return strings;
 }
 
 
@@ -2891,7 +2986,7 @@ static void debug_print_tree(struct pipe *pi, int lvl)
 static struct pipe *new_pipe(void)
 {
 	struct pipe *pi;
-	pi = xzalloc(sizeof(struct pipe));
+	pi = arena_zalloc(sizeof(struct pipe));
 	/*pi->followup = 0; - deliberately invalid value */
 	/*pi->res_word = RES_NONE; - RES_NONE is 0 anyway */
 	return pi;
@@ -2922,7 +3017,9 @@ static int done_command(struct parse_context *ctx)
 
 	/* Only real trickiness here is that the uncommitted
 	 * command structure is not counted in pi->num_cmds. */
-	pi->cmds = xrealloc(pi->cmds, sizeof(*pi->cmds) * (pi->num_cmds+1));
+	pi->cmds = arena_realloc(pi->cmds,
+			sizeof(*pi->cmds) * pi->num_cmds,
+			sizeof(*pi->cmds) * (pi->num_cmds+1));
 	ctx->command = command = &pi->cmds[pi->num_cmds];
  clear_and_ret:
 	memset(command, 0, sizeof(*command));
@@ -3126,6 +3223,10 @@ static int reserved_word(o_string *word, struct parse_context *ctx)
 		 * if { echo foo; } then { echo bar; } fi */
 		if (ctx->command->group)
 			done_pipe(ctx, PIPE_SEQ);
+#if ENABLE_FEATURE_SH_PROFILE
+		/* "do cmd": cmd's line is where cmd starts, not "do" */
+		ctx->command->lineno = 0;
+#endif
 	}
 
 	ctx->ctx_res_w = r->res;
@@ -3144,7 +3245,7 @@ static int reserved_word(o_string *word, struct parse_context *ctx)
 # if !BB_MMU
 		o_addstr(&old->as_string, ctx->as_string.data);
 		o_free_unsafe(&ctx->as_string);
-		old->command->group_as_string = xstrdup(old->as_string.data);
+		old->command->group_as_string = arena_strdup(old->as_string.data);
 		debug_printf_parse("pop, remembering as:'%s'\n",
 				old->command->group_as_string);
 # endif
@@ -3182,7 +3283,7 @@ static int done_word(o_string *word, struct parse_context *ctx)
 		 * shell may perform it, but shall do so only when
 		 * the expansion would result in one word."
 		 */
-		ctx->pending_redirect->rd_filename = xstrdup(word->data);
+		ctx->pending_redirect->rd_filename = arena_strdup(word->data);
 		/* Cater for >\file case:
 		 * >\a creates file a; >\\a, >"\a", >"\\a" create file \a
 		 * Same with heredocs:
@@ -3271,7 +3372,7 @@ static int done_word(o_string *word, struct parse_context *ctx)
 				p += 3;
 			}
 		}
-		command->argv = add_string_to_strings(command->argv, xstrdup(word->data));
+		command->argv = arena_add_string(command->argv, word->data);
 		debug_print_strings("word appended to argv", command->argv);
 	}
 
@@ -3395,7 +3496,7 @@ static int parse_redirect(struct parse_context *ctx,
 	while ((redir = *redirp) != NULL) {
 		redirp = &(redir->next);
 	}
-	*redirp = redir = xzalloc(sizeof(*redir));
+	*redirp = redir = arena_zalloc(sizeof(*redir));
 	/* redir->next = NULL; */
 	/* redir->rd_filename = NULL; */
 	redir->rd_type = style;
@@ -3537,8 +3638,8 @@ static int fetch_heredocs(int heredoc_cnt, struct parse_context *ctx, struct in_
 						syntax_error("unexpected EOF in here document");
 						return 1;
 					}
-					free(redir->rd_filename);
-					redir->rd_filename = p;
+					redir->rd_filename = arena_strdup(p);
+					free(p);
 					heredoc_cnt--;
 				}
 				redir = redir->next;
@@ -3610,6 +3711,7 @@ static int parse_group(o_string *dest, struct parse_context *ctx,
 		}
 		nommu_addchr(&ctx->as_string, ch);
 		command->cmd_type = CMD_FUNCDEF;
+		command->arena = G.parse_arena;
 		goto skip;
 	}
 #endif
@@ -3666,7 +3768,8 @@ static int parse_group(o_string *dest, struct parse_context *ctx,
 		command->group = pipe_list;
 #if !BB_MMU
 		as_string[strlen(as_string) - 1] = '\0'; /* plink ')' or '}' */
-		command->group_as_string = as_string;
+		command->group_as_string = arena_strdup(as_string);
+		free(as_string);
 		debug_printf_parse("end of group, remembering as:'%s'\n",
 				command->group_as_string);
 #endif
@@ -4225,8 +4328,7 @@ static struct pipe *parse_stream(char **pstring,
 			if (pi->num_cmds == 0
 			    IF_HAS_KEYWORDS( && pi->res_word == RES_NONE)
 			) {
-				free_pipe_list(pi);
-				pi = NULL;
+				pi = NULL; /* (caller frees the arena) */
 			}
 #if !BB_MMU
 			debug_printf_parse("as_string '%s'\n", ctx.as_string.data);
@@ -4263,6 +4365,11 @@ static struct pipe *parse_stream(char **pstring,
 		}
 		is_special = strchr(is_special, ch);
 		is_blank = strchr(defifs, ch);
+#if ENABLE_FEATURE_SH_PROFILE
+		/* Command's line is where its first word starts */
+		if (!is_blank && ch != '#' && !ctx.command->lineno)
+			ctx.command->lineno = input->lineno + 1;
+#endif
 
 		if (!is_special && !is_blank) { /* ordinary char */
  ordinary_char:
@@ -4663,24 +4770,14 @@ static struct pipe *parse_stream(char **pstring,
 		struct parse_context *pctx;
 		IF_HAS_KEYWORDS(struct parse_context *p2;)
 
-		/* Clean up allocated tree.
+		/* Clean up context stack. The tree itself is in
+		 * G.parse_arena, caller frees it.
 		 * Sample for finding leaks on syntax error recovery path.
 		 * Run it from interactive shell, watch pmap `pidof hush`.
 		 * while if false; then false; fi; do break; fi
-		 * Samples to catch leaks at execution:
-		 * while if (true | {true;}); then echo ok; fi; do break; done
-		 * while if (true | {true;}); then echo ok; fi; do (if echo ok; break; then :; fi) | cat; break; done
 		 */
 		pctx = &ctx;
 		do {
-			/* Update pipe/command counts,
-			 * otherwise freeing may miss some */
-			done_pipe(pctx, PIPE_SEQ);
-			debug_printf_clean("freeing list %p from ctx %p\n",
-					pctx->list_head, pctx);
-			debug_print_tree(pctx->list_head, 0);
-			free_pipe_list(pctx->list_head);
-			debug_printf_clean("freed list %p\n", pctx->list_head);
 #if !BB_MMU
 			o_free_unsafe(&pctx->as_string);
 #endif
@@ -5731,7 +5828,7 @@ static void re_execute_shell(char ***to_free, const char *s,
 #endif  /* !BB_MMU */
 
 
-static int run_and_free_list(struct pipe *pi);
+static int run_and_free_list(struct pipe *pi, struct parse_arena *arena);
 
 /* Executing from string: eval, sh -c '...'
  *          or from file: /etc/profile, . file, sh <script>, sh (intereactive)
@@ -5750,13 +5847,18 @@ static void parse_and_run_stream(struct in_str *inp, int end_trigger)
 	bool empty = 1;
 	while (1) {
 		struct pipe *pipe_list;
+		struct parse_arena *arena, *sv_arena;
 
 #if ENABLE_HUSH_INTERACTIVE
 		if (end_trigger == ';')
 			inp->promptmode = 0; /* PS1 */
 #endif
+		sv_arena = G.parse_arena;
+		G.parse_arena = arena = arena_new();
 		pipe_list = parse_stream(NULL, inp, end_trigger);
+		G.parse_arena = sv_arena;
 		if (!pipe_list || pipe_list == ERR_PTR) { /* EOF/error */
+			arena_unref(arena);
 			/* If we are in "big" script
 			 * (not in `cmd` or something similar)...
 			 */
@@ -5779,7 +5881,7 @@ static void parse_and_run_stream(struct in_str *inp, int end_trigger)
 		}
 		debug_print_tree(pipe_list, 0);
 		debug_printf_exec("parse_and_run_stream: run_and_free_list\n");
-		run_and_free_list(pipe_list);
+		run_and_free_list(pipe_list, arena);
 		empty = 0;
 #if ENABLE_HUSH_FUNCTIONS
 		if (G.flag_return_in_progress == 1)
@@ -5814,6 +5916,8 @@ static FILE *generate_stream_from_string(const char *s, pid_t *pid_p)
 	xpipe(channel);
 	pid = BB_MMU ? xfork() : xvfork();
 	if (pid == 0) { /* child */
+		if (BB_MMU && sh_prof_enabled)
+			sh_prof_disable();
 		disable_restore_tty_pgrp_on_exit();
 		/* Process substitution is not considered to be usual
 		 * 'command execution'.
@@ -5891,6 +5995,8 @@ static FILE *generate_stream_from_string(const char *s, pid_t *pid_p)
 
 	/* parent */
 	*pid_p = pid;
+	if (sh_prof_enabled)
+		sh_prof_fork(1);
 # if ENABLE_HUSH_FAST
 	G.count_SIGCHLD++;
 //bb_error_msg("[%d] fork in generate_stream_from_string:"
@@ -6182,7 +6288,8 @@ static const struct function *find_function(const char *name)
 	return funcp;
 }
 
-/* Note: takes ownership on name ptr */
+/* Note: name is not copied. It is in parse tree,
+ * or in argv (-F name body), and lives as long as the function */
 static struct function *new_function(char *name)
 {
 	struct function **funcpp = find_function_slot(name);
@@ -6191,19 +6298,7 @@ static struct function *new_function(char *name)
 	if (funcp != NULL) {
 		struct command *cmd = funcp->parent_cmd;
 		debug_printf_exec("func %p parent_cmd %p\n", funcp, cmd);
-		if (!cmd) {
-			debug_printf_exec("freeing & replacing function '%s'\n", funcp->name);
-			free(funcp->name);
-			/* Note: if !funcp->body, do not free body_as_string!
-			 * This is a special case of "-F name body" function:
-			 * body_as_string was not malloced! */
-			if (funcp->body) {
-				free_pipe_list(funcp->body);
-# if !BB_MMU
-				free(funcp->body_as_string);
-# endif
-			}
-		} else {
+		if (cmd) {
 			debug_printf_exec("reinserting in tree & replacing function '%s'\n", funcp->name);
 			cmd->argv[0] = funcp->name;
 			cmd->group = funcp->body;
@@ -6211,6 +6306,12 @@ static struct function *new_function(char *name)
 			cmd->group_as_string = funcp->body_as_string;
 # endif
 		}
+		/* Frees the body unless its tree is still in use.
+		 * "-F name body" function has no arena */
+		arena_unref(funcp->arena);
+		funcp->arena = NULL;
+		funcp->parent_cmd = NULL;
+		funcp->body = NULL;
 	} else {
 		debug_printf_exec("remembering new function '%s'\n", name);
 		funcp = *funcpp = xzalloc(sizeof(*funcp));
@@ -6230,16 +6331,8 @@ static void unset_func(const char *name)
 		debug_printf_exec("freeing function '%s'\n", funcp->name);
 		*funcpp = funcp->next;
 		/* funcp is unlinked now, deleting it.
-		 * Note: if !funcp->body, the function was created by
-		 * "-F name body", do not free ->body_as_string
-		 * and ->name as they were not malloced. */
-		if (funcp->body) {
-			free_pipe_list(funcp->body);
-			free(funcp->name);
-# if !BB_MMU
-			free(funcp->body_as_string);
-# endif
-		}
+		 * Its name and body are in the arena */
+		arena_unref(funcp->arena);
 		free(funcp);
 	}
 }
@@ -6300,7 +6393,15 @@ static int run_function(const struct function *funcp, char **argv)
 	} else
 # endif
 	{
+		/* Function can redefine or unset itself */
+		struct parse_arena *arena = arena_ref(funcp->arena);
+
+		if (sh_prof_enabled)
+			sh_prof_func_enter(funcp->name);
 		rc = run_list(funcp->body);
+		if (sh_prof_enabled)
+			sh_prof_func_leave();
+		arena_unref(arena);
 	}
 
 # if ENABLE_HUSH_LOCAL
@@ -6550,7 +6651,7 @@ static void pseudo_exec(nommu_save_t *nommu_save,
 		debug_printf_exec("pseudo_exec: run_list\n");
 		reset_traps_to_defaults();
 		rcode = run_list(command->group);
-		/* OK to leak memory by not calling free_pipe_list,
+		/* OK to not free the tree,
 		 * since this process is about to exit */
 		_exit(rcode);
 #else
@@ -6568,29 +6669,29 @@ static void pseudo_exec(nommu_save_t *nommu_save,
 }
 
 #if ENABLE_HUSH_JOB
-static const char *get_cmdtext(struct pipe *pi)
+/* Returns malloced string */
+static char *get_cmdtext(struct pipe *pi)
 {
 	char **argv;
-	char *p;
+	char *p, *cmdtext;
 	int len;
 
 	/* This is subtle. ->cmdtext is created only on first backgrounding.
 	 * (Think "cat, <ctrl-z>, fg, <ctrl-z>, fg, <ctrl-z>...." here...)
-	 * On subsequent bg argv is trashed, but we won't use it */
+	 * On subsequent bg argv is trashed, but we won't use it.
+	 * pi is either a job (has ->cmdtext), or is in parse tree:
+	 * do not store malloced data there, nobody would free it */
 	if (pi->cmdtext)
-		return pi->cmdtext;
+		return xstrdup(pi->cmdtext);
 	argv = pi->cmds[0].argv;
-	if (!argv || !argv[0]) {
-		pi->cmdtext = xzalloc(1);
-		return pi->cmdtext;
-	}
+	if (!argv || !argv[0])
+		return xzalloc(1);
 
 	len = 0;
 	do {
 		len += strlen(*argv) + 1;
 	} while (*++argv);
-	p = xmalloc(len);
-	pi->cmdtext = p;
+	p = cmdtext = xmalloc(len);
 	argv = pi->cmds[0].argv;
 	do {
 		len = strlen(*argv);
@@ -6599,7 +6700,7 @@ static const char *get_cmdtext(struct pipe *pi)
 		*p++ = ' ';
 	} while (*++argv);
 	p[-1] = '\0';
-	return pi->cmdtext;
+	return cmdtext;
 }
 
 static void insert_bg_job(struct pipe *pi)
@@ -6627,7 +6728,7 @@ static void insert_bg_job(struct pipe *pi)
 		job->cmds[i].pid = pi->cmds[i].pid;
 		/* all other fields are not used and stay zero */
 	}
-	job->cmdtext = xstrdup(get_cmdtext(pi));
+	job->cmdtext = get_cmdtext(pi);
 
 	if (G_interactive_fd)
 		printf("[%d] %d %s\n", job->jobid, job->cmds[0].pid, job->cmdtext);
@@ -6656,7 +6757,10 @@ static void remove_bg_job(struct pipe *pi)
 static void delete_finished_bg_job(struct pipe *pi)
 {
 	remove_bg_job(pi);
-	free_pipe(pi);
+	/* Jobs are not in parse tree, they are malloced copies */
+	free(pi->cmds);
+	free(pi->cmdtext);
+	free(pi);
 }
 #endif /* JOB */
 
@@ -6877,6 +6981,29 @@ static int checkjobs_and_fg_shell(struct pipe *fg_pipe)
  * backgrounded: cmd &     { list } &
  * subshell:     ( list ) [&]
  */
+#if ENABLE_HUSH_NOFORK_APPLETS
+/* Is applet n listed in CONFIG_HUSH_NOFORK_APPLETS? */
+static int is_listed_nofork(int n)
+{
+	const char *list = CONFIG_HUSH_NOFORK_APPLETS;
+	const char *name = APPLET_NAME(n);
+	unsigned len = strlen(name);
+	const char *p = list;
+
+	while ((p = strstr(p, name)) != NULL) {
+		if ((p == list || p[-1] == ' ')
+		 && (p[len] == ' ' || p[len] == '\0')
+		) {
+			return 1;
+		}
+		p += len;
+	}
+	return 0;
+}
+#else
+# define is_listed_nofork(n) 0
+#endif
+
 #if !ENABLE_HUSH_MODE_X
 #define redirect_and_varexp_helper(new_env_p, old_vars_p, command, squirrel, argv_expanded) \
 	redirect_and_varexp_helper(new_env_p, old_vars_p, command, squirrel)
@@ -6929,6 +7056,10 @@ static NOINLINE int run_pipe(struct pipe *pi)
 	pi->stopped_cmds = 0;
 	command = &pi->cmds[0];
 	argv_expanded = NULL;
+#if ENABLE_FEATURE_SH_PROFILE
+	if (sh_prof_enabled)
+		sh_prof_line(G.prof_script, command->lineno);
+#endif
 
 	if (pi->num_cmds != 1
 	 || pi->followup == PIPE_BG
@@ -6951,6 +7082,7 @@ static NOINLINE int run_pipe(struct pipe *pi)
 			funcp = new_function(command->argv[0]);
 			/* funcp->name is already set to argv[0] */
 			funcp->body = command->group;
+			funcp->arena = arena_ref(command->arena);
 # if !BB_MMU
 			funcp->body_as_string = command->group_as_string;
 			command->group_as_string = NULL;
@@ -6959,7 +7091,6 @@ static NOINLINE int run_pipe(struct pipe *pi)
 			command->argv[0] = NULL;
 			debug_printf_exec("cmd %p has child func at %p\n", command, funcp);
 			funcp->parent_cmd = command;
-			command->child_func = funcp;
 
 			debug_printf_exec("run_pipe: return EXIT_SUCCESS\n");
 			debug_leave();
@@ -7120,7 +7251,7 @@ static NOINLINE int run_pipe(struct pipe *pi)
 
 		if (ENABLE_FEATURE_SH_NOFORK) {
 			int n = find_applet_by_name(argv_expanded[0]);
-			if (n >= 0 && APPLET_IS_NOFORK(n)) {
+			if (n >= 0 && (APPLET_IS_NOFORK(n) || is_listed_nofork(n))) {
 				rcode = redirect_and_varexp_helper(&new_env, &old_vars, command, squirrel, argv_expanded);
 				if (rcode == 0) {
 					debug_printf_exec(": run_nofork_applet '%s' '%s'...\n",
@@ -7169,6 +7300,9 @@ static NOINLINE int run_pipe(struct pipe *pi)
 
 		command->pid = BB_MMU ? fork() : vfork();
 		if (!command->pid) { /* child */
+			/* (vforked child shares our memory, it will exec soon) */
+			if (BB_MMU && sh_prof_enabled)
+				sh_prof_disable();
 #if ENABLE_HUSH_JOB
 			disable_restore_tty_pgrp_on_exit();
 			CLEAR_RANDOM_T(&G.random_gen); /* or else $RANDOM repeats in child */
@@ -7234,6 +7368,8 @@ static NOINLINE int run_pipe(struct pipe *pi)
 			bb_perror_msg(BB_MMU ? "vfork"+1 : "vfork");
 		} else {
 			pi->alive_cmds++;
+			if (sh_prof_enabled)
+				sh_prof_fork(command->group != NULL);
 #if ENABLE_HUSH_JOB
 			/* Second and next children need to know pid of first one */
 			if (pi->pgrp < 0)
@@ -7594,7 +7730,7 @@ static int run_list(struct pipe *pi)
 }
 
 /* Select which version we will use */
-static int run_and_free_list(struct pipe *pi)
+static int run_and_free_list(struct pipe *pi, struct parse_arena *arena)
 {
 	int rcode = 0;
 	debug_printf_exec("run_and_free_list entered\n");
@@ -7602,10 +7738,8 @@ static int run_and_free_list(struct pipe *pi)
 		debug_printf_exec(": run_list: 1st pipe with %d cmds\n", pi->num_cmds);
 		rcode = run_list(pi);
 	}
-	/* free_pipe_list has the side effect of clearing memory.
-	 * In the long run that function can be merged with run_list,
-	 * but doing that now would hobble the debugging effort. */
-	free_pipe_list(pi);
+	/* Functions defined by pi hold their own references */
+	arena_unref(arena);
 	debug_printf_exec("run_and_free_list return %d\n", rcode);
 	return rcode;
 }
@@ -7744,6 +7878,8 @@ int hush_main(int argc, char **argv)
 	INIT_G();
 	if (EXIT_SUCCESS != 0) /* if EXIT_SUCCESS == 0, it is already done */
 		G.last_exitcode = EXIT_SUCCESS;
+	if (ENABLE_FEATURE_SH_PROFILE)
+		sh_prof_init(); /* before we import environment */
 #if ENABLE_HUSH_FAST
 	G.count_SIGCHLD++; /* ensure it is != G.handled_SIGCHLD */
 #endif
@@ -8015,6 +8151,7 @@ int hush_main(int argc, char **argv)
 		debug_printf("running script '%s'\n", G.global_argv[0]);
 		input = xfopen_for_read(G.global_argv[0]);
 		close_on_exec_on(fileno(input));
+		IF_FEATURE_SH_PROFILE(G.prof_script = G.global_argv[0];)
 		install_special_sighandlers();
 		parse_and_run_file(input);
 #if ENABLE_FEATURE_CLEAN_UP
@@ -8867,6 +9004,9 @@ static int FAST_FUNC builtin_source(char **argv)
 #if ENABLE_HUSH_FUNCTIONS
 	smallint sv_flg;
 #endif
+#if ENABLE_FEATURE_SH_PROFILE
+	const char *sv_script = G.prof_script;
+#endif
 
 	argv = skip_dash_dash(argv);
 	filename = argv[0];
@@ -8893,11 +9033,14 @@ static int FAST_FUNC builtin_source(char **argv)
 	/* "we are inside sourced file, ok to use return" */
 	G.flag_return_in_progress = -1;
 #endif
+	/* before argv[0] gets replaced by $0 */
+	IF_FEATURE_SH_PROFILE(G.prof_script = argv[0];)
 	save_and_replace_G_args(&sv, argv);
 
 	parse_and_run_file(input);
 	fclose(input);
 
+	IF_FEATURE_SH_PROFILE(G.prof_script = sv_script;)
 	restore_G_args(&sv, argv);
 #if ENABLE_HUSH_FUNCTIONS
 	G.flag_return_in_progress = sv_flg;
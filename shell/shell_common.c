@@ -497,3 +497,324 @@ shell_builtin_ulimit(char **argv)
 
 	return 0;
 }
+
+#if ENABLE_FEATURE_SH_PROFILE
+/* Script profiler, enabled by $SH_PROFILE=FILE.
+ *
+ * The shell reports each simple command it starts (sh_prof_line) and
+ * each function call (sh_prof_func_enter/leave). Wall time between two
+ * such events is charged to the line which was running, and to that
+ * line in its current call path for the folded stacks output.
+ */
+struct prof_line {
+	struct prof_line *next;
+	const char *where;      /* script or function name */
+	unsigned lineno;
+	unsigned count;
+	unsigned forks;
+	smallint in_func;
+	unsigned long long us;
+};
+
+struct prof_func {
+	struct prof_func *next;
+	unsigned calls;
+	unsigned active;        /* recursion depth */
+	unsigned long long start;
+	unsigned long long us;  /* including callees */
+	char name[1];
+};
+
+/* Node of the call path tree */
+struct prof_path {
+	struct prof_path *parent;
+	struct prof_path *child;
+	struct prof_path *sibling;
+	struct prof_func *func;
+	struct prof_line *caller;
+};
+
+struct prof_sample {
+	struct prof_sample *next;
+	struct prof_path *path;
+	struct prof_line *line;
+	unsigned long long us;
+};
+
+enum { PROF_HASH = 1024 };
+
+struct sh_prof {
+	char *file;
+	unsigned long long start;
+	unsigned long long last;
+	struct prof_line *cur;
+	struct prof_path *path;
+	unsigned forks;
+	unsigned subshells;
+	unsigned nlines;
+	unsigned nfuncs;
+	unsigned nsamples;
+	char **names;           /* interned script names */
+	unsigned nnames;
+	struct prof_path root;
+	struct prof_func *funcs;
+	struct prof_line *lines[PROF_HASH];
+	struct prof_sample *samples[PROF_HASH];
+};
+
+smallint sh_prof_enabled;
+static struct sh_prof *prof;
+
+void FAST_FUNC sh_prof_init(void)
+{
+	char *file = getenv("SH_PROFILE");
+
+	if (!file || !file[0])
+		return;
+	prof = xzalloc(sizeof(*prof));
+	prof->file = xstrdup(file);
+	/* Scripts we run would overwrite our report */
+	unsetenv("SH_PROFILE");
+	prof->start = prof->last = monotonic_us();
+	prof->path = &prof->root;
+	sh_prof_enabled = 1;
+}
+
+void FAST_FUNC sh_prof_disable(void)
+{
+	/* Forked child: time spent here is charged to the parent's line */
+	sh_prof_enabled = 0;
+}
+
+static void prof_charge(void)
+{
+	unsigned long long now = monotonic_us();
+	unsigned long long delta = now - prof->last;
+	struct prof_sample *s, **sp;
+
+	prof->last = now;
+	if (!prof->cur)
+		return;
+	prof->cur->us += delta;
+
+	sp = &prof->samples[((uintptr_t)prof->path / 16 + (uintptr_t)prof->cur / 16) % PROF_HASH];
+	for (s = *sp; s; s = s->next)
+		if (s->path == prof->path && s->line == prof->cur)
+			goto found;
+	s = xzalloc(sizeof(*s));
+	s->path = prof->path;
+	s->line = prof->cur;
+	s->next = *sp;
+	*sp = s;
+	prof->nsamples++;
+ found:
+	s->us += delta;
+}
+
+static const char *prof_intern(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < prof->nnames; i++)
+		if (strcmp(prof->names[i], name) == 0)
+			return prof->names[i];
+	prof->names = xrealloc_vector(prof->names, 3, prof->nnames);
+	return prof->names[prof->nnames++] = xstrdup(name);
+}
+
+void FAST_FUNC sh_prof_line(const char *script, unsigned lineno)
+{
+	struct prof_line *l, **lp;
+	const char *where;
+	smallint in_func;
+
+	prof_charge();
+	/* Lines of a function are numbered in the file it came from,
+	 * which we don't know. Show them as "func():N" */
+	in_func = (prof->path->func != NULL);
+	where = in_func ? prof->path->func->name : prof_intern(script ? script : "-");
+
+	lp = &prof->lines[((uintptr_t)where / 16 + lineno * 31) % PROF_HASH];
+	for (l = *lp; l; l = l->next)
+		if (l->where == where && l->lineno == lineno && l->in_func == in_func)
+			goto found;
+	l = xzalloc(sizeof(*l));
+	l->where = where;
+	l->lineno = lineno;
+	l->in_func = in_func;
+	l->next = *lp;
+	*lp = l;
+	prof->nlines++;
+ found:
+	l->count++;
+	prof->cur = l;
+}
+
+void FAST_FUNC sh_prof_func_enter(const char *name)
+{
+	struct prof_func *f;
+	struct prof_path *p;
+
+	prof_charge();
+	for (f = prof->funcs; f; f = f->next)
+		if (strcmp(f->name, name) == 0)
+			goto found;
+	f = xzalloc(sizeof(*f) + strlen(name));
+	strcpy(f->name, name);
+	f->next = prof->funcs;
+	prof->funcs = f;
+	prof->nfuncs++;
+ found:
+	f->calls++;
+	if (f->active++ == 0)
+		f->start = prof->last;
+
+	for (p = prof->path->child; p; p = p->sibling)
+		if (p->func == f)
+			goto found_path;
+	p = xzalloc(sizeof(*p));
+	p->parent = prof->path;
+	p->func = f;
+	p->sibling = prof->path->child;
+	prof->path->child = p;
+ found_path:
+	p->caller = prof->cur;
+	prof->path = p;
+}
+
+void FAST_FUNC sh_prof_func_leave(void)
+{
+	struct prof_path *p = prof->path;
+	struct prof_func *f = p->func;
+
+	if (!f) /* can't happen */
+		return;
+	prof_charge();
+	if (--f->active == 0)
+		f->us += prof->last - f->start;
+	prof->cur = p->caller;
+	prof->path = p->parent;
+}
+
+void FAST_FUNC sh_prof_fork(int subshell)
+{
+	prof->forks++;
+	prof->subshells += subshell;
+	if (prof->cur)
+		prof->cur->forks++;
+}
+
+static int prof_cmp_line(const void *a, const void *b)
+{
+	const struct prof_line *la = *(const struct prof_line **)a;
+	const struct prof_line *lb = *(const struct prof_line **)b;
+
+	if (la->us != lb->us)
+		return la->us < lb->us ? 1 : -1;
+	return (int)la->count - (int)lb->count;
+}
+
+static int prof_cmp_func(const void *a, const void *b)
+{
+	const struct prof_func *fa = *(const struct prof_func **)a;
+	const struct prof_func *fb = *(const struct prof_func **)b;
+
+	if (fa->us != fb->us)
+		return fa->us < fb->us ? 1 : -1;
+	return strcmp(fa->name, fb->name);
+}
+
+static void prof_put_path(FILE *fp, struct prof_path *p)
+{
+	if (p->parent)
+		prof_put_path(fp, p->parent);
+	fputs(p->func ? p->func->name : "main", fp);
+	fputc(';', fp);
+}
+
+static void prof_put_line(FILE *fp, const struct prof_line *l)
+{
+	fprintf(fp, l->in_func ? "%s():%u" : "%s:%u", l->where, l->lineno);
+}
+
+void FAST_FUNC sh_prof_finish(void)
+{
+	struct prof_line **lines;
+	struct prof_func **funcs, *f;
+	struct prof_sample *s;
+	FILE *fp;
+	char *folded;
+	unsigned i, n;
+
+	/* Everything still running was called from its caller's line */
+	while (prof->path->func)
+		sh_prof_func_leave();
+	prof_charge();
+	sh_prof_enabled = 0;
+
+	fp = fopen_or_warn(prof->file, "w");
+	if (!fp)
+		return;
+
+	lines = xmalloc((prof->nlines + 1) * sizeof(lines[0]));
+	n = 0;
+	for (i = 0; i < PROF_HASH; i++) {
+		struct prof_line *l;
+		for (l = prof->lines[i]; l; l = l->next)
+			lines[n++] = l;
+	}
+	qsort(lines, n, sizeof(lines[0]), prof_cmp_line);
+	fprintf(fp, "# %llu.%06u seconds, %u forks (%u subshells)\n"
+		"#\n"
+		"# time by line, not including called functions\n"
+		"#   seconds      count  forks  line\n",
+		(prof->last - prof->start) / 1000000,
+		(unsigned)((prof->last - prof->start) % 1000000),
+		prof->forks, prof->subshells
+	);
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "%4llu.%06u %10u %6u  ",
+			lines[i]->us / 1000000, (unsigned)(lines[i]->us % 1000000),
+			lines[i]->count, lines[i]->forks
+		);
+		prof_put_line(fp, lines[i]);
+		fputc('\n', fp);
+	}
+	free(lines);
+
+	funcs = xmalloc((prof->nfuncs + 1) * sizeof(funcs[0]));
+	n = 0;
+	for (f = prof->funcs; f; f = f->next)
+		funcs[n++] = f;
+	qsort(funcs, n, sizeof(funcs[0]), prof_cmp_func);
+	fprintf(fp, "#\n"
+		"# time by function, including called functions\n"
+		"#   seconds      calls  function\n"
+	);
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "%4llu.%06u %10u  %s\n",
+			funcs[i]->us / 1000000, (unsigned)(funcs[i]->us % 1000000),
+			funcs[i]->calls, funcs[i]->name
+		);
+	}
+	free(funcs);
+	fclose(fp);
+
+	/* "main;func1;func2;func2():LINE MICROSECONDS", for flamegraph.pl */
+	folded = xasprintf("%s.folded", prof->file);
+	fp = fopen_or_warn(folded, "w");
+	free(folded);
+	if (!fp)
+		return;
+	for (i = 0; i < PROF_HASH; i++) {
+		for (s = prof->samples[i]; s; s = s->next) {
+			if (!s->us)
+				continue;
+			prof_put_path(fp, s->path);
+			prof_put_line(fp, s->line);
+			fprintf(fp, " %llu\n", s->us);
+		}
+	}
+	fclose(fp);
+}
+#endif
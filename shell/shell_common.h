@@ -46,6 +46,21 @@ shell_builtin_read(void FAST_FUNC (*setvar)(const char *name, const char *val),
 int FAST_FUNC
 shell_builtin_ulimit(char **argv);
 
+/* Profiler: call only if sh_prof_enabled */
+
+#if ENABLE_FEATURE_SH_PROFILE
+extern smallint sh_prof_enabled;
+#else
+# define sh_prof_enabled 0
+#endif
+void FAST_FUNC sh_prof_init(void);
+void FAST_FUNC sh_prof_disable(void);
+void FAST_FUNC sh_prof_line(const char *script, unsigned lineno);
+void FAST_FUNC sh_prof_func_enter(const char *name);
+void FAST_FUNC sh_prof_func_leave(void);
+void FAST_FUNC sh_prof_fork(int subshell);
+void FAST_FUNC sh_prof_finish(void);
+
 POP_SAVED_FUNCTION_VISIBILITY
 
 #endif